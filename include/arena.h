@@ -0,0 +1,74 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#ifndef __ARENA_H__
+#define __ARENA_H__ 1
+
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+//Memory that only lives for one frame. Each thread bumps a pointer in its
+//own region and Reset hands everything back at once. A region that runs
+//out falls back to malloc for the rest of the frame and Reset grows it to
+//what the frame wanted, so after the first frames nothing reaches malloc.
+class FrameArena {
+public:
+  //Every allocation is rounded to whole cache lines, so two threads never
+  //write to the same line
+  static const size_t kAlignment = 64;
+
+  FrameArena() = default;
+  ~FrameArena();
+  FrameArena(const FrameArena&) = delete;
+  FrameArena& operator=(const FrameArena&) = delete;
+
+  //One region per thread that allocates, more threads share them
+  void Init(unsigned int regions, size_t region_bytes);
+  //Nothing allocated since the last Reset can be in use
+  void Reset();
+
+  void* Allocate(size_t bytes);
+  //Uninitialized, for plain data
+  template <typename T> T* Allocate(size_t count) { return (T*)Allocate(sizeof(T) * count); }
+
+  //Since the last Reset
+  size_t bytes() const { return bytes_; }
+  unsigned int allocations() const { return allocations_; }
+  unsigned int fallbacks() const { return fallbacks_; }
+
+  //px_sched MemCallbacks. The scheduler keeps its memory until it is
+  //destroyed so it can't come from a frame, it is only counted.
+  static void* SchedulerAlloc(size_t bytes);
+  static void SchedulerFree(void* ptr);
+  static size_t scheduler_bytes();
+
+private:
+  void Release();
+
+  struct alignas(kAlignment) Region {
+    unsigned char* base = nullptr;
+    size_t size = 0;
+    //Keeps growing past size when full, Reset reads what was wanted
+    std::atomic<size_t> used;
+  };
+
+  Region* regions_ = nullptr;
+  unsigned int region_count_ = 0;
+
+  std::atomic<size_t> bytes_{0};
+  std::atomic<unsigned int> allocations_{0};
+  std::atomic<unsigned int> fallbacks_{0};
+
+  std::mutex fallback_mutex_;
+  std::vector<void*> fallback_blocks_;
+};
+
+#endif
@@ -0,0 +1,81 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#ifndef __FRAME_WRITER_H__
+#define __FRAME_WRITER_H__ 1
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "renderer.h"
+
+//Encodes and writes finished frames on its own thread. The frames live in
+//a fixed pool: the renderer draws into one from Acquire, Submit hands it
+//to the writer and it goes back to the pool once it is on disk. When every
+//buffer is queued Acquire waits, so a slow disk holds the renderer back
+//instead of piling up frames.
+class FrameWriter {
+public:
+  FrameWriter();
+  ~FrameWriter();
+  FrameWriter(const FrameWriter&) = delete;
+  FrameWriter& operator=(const FrameWriter&) = delete;
+
+  //Allocates the pool and starts the thread
+  void Init(unsigned int width, unsigned int height, unsigned int buffers);
+  //Writes what is queued and stops the thread
+  void Shutdown();
+
+  //A free frame, owned by the caller until it is submitted
+  TScreen* Acquire();
+  //Hands the frame over, see WriteImage for the formats
+  void Submit(const TScreen* frame, const std::string& path);
+  //Returns once every submitted frame is written
+  void Flush();
+
+  //Up to date after Flush
+  unsigned int frames_written() const { return frames_written_; }
+  unsigned int failed_writes() const { return failed_writes_; }
+  //Spent on the writer thread encoding and writing
+  float write_time() const { return write_ms_; }
+  //Spent in Acquire waiting for a free buffer
+  float stall_time() const { return stall_ms_; }
+
+private:
+  struct Buffer {
+    TScreen image;
+    std::vector<unsigned int> pixels;
+    std::string path;
+  };
+
+  void WriterLoop();
+  Buffer* Find(const TScreen* frame);
+
+  //Never resized after Init, the frames point into it
+  std::vector<Buffer> buffers_;
+  std::vector<Buffer*> free_;
+  std::deque<Buffer*> queue_;
+  bool writing_;
+  bool quit_;
+  std::mutex mutex_;
+  std::condition_variable work_ready_;
+  std::condition_variable buffer_free_;
+  std::thread thread_;
+
+  unsigned int frames_written_;
+  unsigned int failed_writes_;
+  float write_ms_;
+  float stall_ms_;
+};
+
+#endif
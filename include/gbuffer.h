@@ -0,0 +1,53 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#ifndef __GBUFFER_H__
+#define __GBUFFER_H__ 1
+
+#include "glm/glm.hpp"
+#include "topology.h"
+
+struct RayInfo;
+
+//One hit per pixel stored as structure of arrays, so the passes that walk it
+//only pull the components they use
+struct GBufferLayer {
+  FirstTouchVector<float> pos_x, pos_y, pos_z;
+  FirstTouchVector<float> normal_x, normal_y, normal_z;
+  FirstTouchVector<float> depth;         //-1 when the ray didn't hit anything
+  FirstTouchVector<int> geometry_index;
+
+  //New uninitialized storage, see FirstTouchAllocator
+  void Resize(size_t count);
+  //Pixels [begin, end) become misses
+  void Clear(size_t begin, size_t end);
+
+  void Store(size_t index, const RayInfo& info);
+  //Returns false if the ray missed, color is not stored
+  bool Load(size_t index, RayInfo& info) const;
+
+  void Copy(size_t index, const GBufferLayer& from, size_t from_index);
+};
+
+struct GBuffer {
+  unsigned int width = 0;
+  unsigned int height = 0;
+
+  GBufferLayer primary;
+  GBufferLayer reflection;
+  //1 where the checkerboard interpolated the pixel instead of tracing it,
+  //both layers there hold an older hit that nothing should read
+  FirstTouchVector<unsigned char> reconstructed;
+
+  //Nothing is written until Clear
+  void Resize(unsigned int w, unsigned int h);
+  void Clear(size_t begin, size_t end);
+};
+
+#endif //__GBUFFER_H__
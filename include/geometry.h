@@ -14,7 +14,11 @@ This program is a college project uploaded for showcase purposes.
 
 #include <vector>
 
-struct Ray;
+enum GeometryType {
+  kGeometrySphere = 0,
+  kGeometryPlane,
+  kGeometryMesh,
+};
 
 struct sVertex {
   glm::vec3 position;
@@ -26,8 +30,13 @@ public:
   Geometry() {}
   ~Geometry() {}
 
-  virtual float ComputeRay(Ray& ray) = 0;
-  virtual glm::vec3 GetNormal(glm::vec3& collision_spot) = 0;
+  //Intersections go through HitRecords, the geometry only gives the
+  //normal of the closest hit
+  virtual glm::vec3 GetNormal(const glm::vec3& collision_spot) = 0;
+
+  GeometryType type() const { return type_; }
+  const glm::vec3& box_min() const { return vboxMin; }
+  const glm::vec3& box_max() const { return vboxMax; }
 
   glm::vec3 pos_;
   glm::vec3 color_;
@@ -35,9 +44,9 @@ public:
   float specular_;
 
 protected:
+  GeometryType type_;
   glm::vec3 vboxMin;
   glm::vec3 vboxMax;
-  bool AABBIntersection(Ray ray);
 };
 
 class Sphere : public Geometry {
@@ -45,9 +54,7 @@ public:
   Sphere();
   ~Sphere();
 
-  float ComputeRay(Ray& ray) override;
-
-  glm::vec3 GetNormal(glm::vec3& collision_spot) override;
+  glm::vec3 GetNormal(const glm::vec3& collision_spot) override;
 
   void InitAABB();
 
@@ -59,8 +66,7 @@ public:
   Plane();
   ~Plane();
 
-  float ComputeRay(Ray& ray) override;
-  glm::vec3 GetNormal(glm::vec3& collision_spot) override;
+  glm::vec3 GetNormal(const glm::vec3& collision_spot) override;
 
   glm::vec3 normal_;
 };
@@ -71,19 +77,16 @@ public:
   ~CustomGeometry();
 
   void LoadObj(const char* filePath);
+  //Copies the triangles of another mesh, turned and scaled by transform
+  //around its origin. Set pos_ first.
+  void Instance(const CustomGeometry& mesh, const glm::mat3& transform);
+  //From the vertices and pos_
+  void InitAABB();
 
-  float ComputeRay(Ray& ray) override;
-  glm::vec3 GetNormal(glm::vec3& collision_spot) override;
+  glm::vec3 GetNormal(const glm::vec3& collision_spot) override;
 
   std::vector<sVertex> vertices_;
   std::vector<unsigned short> indices_;
-  glm::vec3 last_normal_;
-  bool use_fast_normal_;
-
-private:
-
-
-  float inline TriCollision(glm::vec3& ro, glm::vec3& rd, glm::vec3& v0, glm::vec3& v1, glm::vec3& v2);
 };
 
 
@@ -0,0 +1,85 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#ifndef __HIT_RECORDS_H__
+#define __HIT_RECORDS_H__ 1
+
+#include "glm/glm.hpp"
+
+#include <vector>
+
+class Geometry;
+struct Ray;
+
+//What intersecting a geometry reads, two to a cache line
+struct HitRecord {
+  glm::vec3 a; //Sphere center, plane normal, mesh bounds min
+  union {
+    float s;            //Sphere radius squared, plane offset: dot(p, a) + s = 0
+    unsigned int mesh;  //Index in the mesh ranges
+  };
+  glm::vec3 b; //Mesh bounds max
+  unsigned int type;
+};
+
+//Mesh triangle already moved to the geometry's position
+struct HitTriangle {
+  glm::vec3 v0, v1, v2;
+};
+
+//Only read when shading a hit
+struct Material {
+  glm::vec3 color;
+  float diffuse;
+  float specular;
+};
+
+//Intersection data of a list of geometries, packed apart from everything
+//that is only needed once the closest hit is known. Record i and
+//material i are geometry i.
+class HitRecords {
+public:
+  //Records go to storage, one per geometry, a cache line aligned block
+  //that has to outlive the frame. Mesh triangles are kept between frames
+  //and only copied again if the geometry changed or a mesh moved.
+  void Build(const std::vector<Geometry*>& geometries, HitRecord* storage, bool geometry_changed);
+  //Copy of from in memory written by the calling thread, so it sits on
+  //that thread's NUMA node. Triangles are only copied again when from
+  //copied new ones since the last time.
+  void Replicate(const HitRecords& from);
+
+  //Closest hit in front of the ray, -1 if none. index gets the geometry.
+  float Intersect(const Ray& ray, int* index) const;
+
+  const Material& material(int index) const { return materials_[index]; }
+
+private:
+  struct MeshRange {
+    unsigned int first;
+    unsigned int count;
+  };
+
+  float IntersectMesh(const HitRecord& record, const Ray& ray) const;
+
+  HitRecord* records_ = nullptr;
+  unsigned int count_ = 0;
+  std::vector<Material> materials_;
+
+  std::vector<MeshRange> meshes_;
+  std::vector<HitTriangle> triangles_;
+  //Where each mesh was when its triangles were copied
+  std::vector<const Geometry*> mesh_sources_;
+  std::vector<glm::vec3> mesh_positions_;
+  //Goes up every time the triangles are copied
+  unsigned int mesh_version_ = 0;
+  //Records of a replica, the built ones live in the caller's storage
+  std::vector<HitRecord> replica_records_;
+};
+
+#endif
@@ -0,0 +1,29 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#ifndef __IMAGE_IO_H__
+#define __IMAGE_IO_H__ 1
+
+#include "glm/glm.hpp"
+
+#include <vector>
+
+struct TScreen;
+
+//8 bit RGB from the ARGB pixels of a screen
+bool WritePPM(const char* path, const TScreen& image);
+//Uncompressed, the deflate stream only has stored blocks
+bool WritePNG(const char* path, const TScreen& image);
+//PNG for a .png path, PPM for anything else
+bool WriteImage(const char* path, const TScreen& image);
+//Linear float RGB, for the colors before the tonemap
+bool WritePFM(const char* path, const std::vector<glm::vec3>& colors,
+  unsigned int width, unsigned int height);
+
+#endif
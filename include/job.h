@@ -0,0 +1,27 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#ifndef __JOB_H__
+#define __JOB_H__ 1
+
+//Scheduler jobs are a plain function and its argument instead of a
+//std::function, so submitting one never allocates. Include this instead of
+//px_sched.h, the definition has to be seen first.
+#define PX_SCHED_CUSTOM_JOB_DEFINITION
+namespace px_sched {
+  struct Job {
+    void (*func)(void* arg);
+    void* arg;
+    void operator()() const { func(arg); }
+  };
+}
+
+#include "px_sched.h"
+
+#endif
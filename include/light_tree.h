@@ -0,0 +1,51 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#ifndef __LIGHT_TREE_H__
+#define __LIGHT_TREE_H__ 1
+
+#include "glm/glm.hpp"
+
+#include <vector>
+
+struct Light;
+
+struct LightTreeNode {
+  glm::vec3 bbox_min;
+  glm::vec3 bbox_max;
+  float intensity;     //Sum of the lights below
+  int left, right;     //-1 on leaves
+  int light_index;     //Only on leaves
+};
+
+//Bounding volume hierarchy over point lights. Used to pick one light with a
+//probability close to its contribution to a point, so the shading cost
+//doesn't grow with the number of lights.
+class LightTree {
+public:
+  LightTree() {}
+  ~LightTree() {}
+
+  void Build(const std::vector<Light>& lights);
+
+  //Returns the index of the chosen light and its probability in pdf,
+  //-1 if no light can reach the point
+  int Sample(const glm::vec3& pos, const glm::vec3& normal, float u, float& pdf) const;
+
+  bool empty() const { return nodes_.empty(); }
+
+private:
+  int BuildNode(const std::vector<Light>& lights, int first, int last);
+  float Importance(const LightTreeNode& node, const glm::vec3& pos, const glm::vec3& normal) const;
+
+  std::vector<LightTreeNode> nodes_;
+  std::vector<int> order_;
+};
+
+#endif //__LIGHT_TREE_H__
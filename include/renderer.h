@@ -12,8 +12,17 @@ This program is a college project uploaded for showcase purposes.
 
 #include "glm/glm.hpp"
 #include <vector>
+#include <atomic>
 
-#include "px_sched.h"
+#include "job.h"
+#include "arena.h"
+#include "hit_records.h"
+#include "sampler.h"
+#include "light_tree.h"
+#include "gbuffer.h"
+#include "scaler.h"
+#include "tonemap.h"
+#include "topology.h"
 
 class Geometry;
 
@@ -24,6 +33,19 @@ struct TScreen {
   unsigned int* pixels;
 };
 
+//Pixel rectangle, x1 and y1 excluded
+struct Tile {
+  int x0, y0;
+  int x1, y1;
+};
+
+//A tile, or a part of one, claimed by a worker in one go
+struct WorkItem {
+  Tile rect;
+  unsigned int tile;  //Index in the Morton ordered tiles
+  float predicted_ms; //From the tile's time in the last frame
+};
+
 struct Camera {
   glm::vec3 pos;
   float focal_length;
@@ -54,7 +76,107 @@ struct RayInfo {
   int geometry_index_;
 };
 
-class Renderer {
+//What to do with each pixel when not all of them are traced
+enum PixelPlan {
+  kPixelTrace = 0,   //Trace and shade from scratch
+  kPixelRefresh,     //Trace and shade, add to the pixel history
+  kPixelReuse,       //Keep the history
+  kPixelReconstruct, //Interpolated from the neighbours after shading
+};
+
+//What changed since the last frame, see Renderer::DetectChanges
+enum FrameChange {
+  kChangeNone = 0,
+  kChangeCamera = 1,
+  kChangeGeometry = 2,
+  kChangeLight = 4,
+  kChangeScreen = 8,
+};
+
+//What one frame did, copied out when it ends so it can be read while the
+//next frames render
+struct FrameStats {
+  unsigned int frame_changes;
+  unsigned int work_items;
+  bool hits_reused;
+  unsigned int accumulated_frames;
+  unsigned int reused_pixels;
+  unsigned int edge_pixels;
+  unsigned long long rays_traced;
+  unsigned int submitted_jobs;
+  float submit_ms;
+  size_t arena_bytes;
+  unsigned int arena_allocations;
+  unsigned int arena_fallbacks;
+};
+
+//Everything the application can change between frames. Each frame renders
+//from its own copy, so it can be edited while earlier frames are still in
+//flight.
+struct RenderSettings {
+  Camera camera_;
+
+  std::vector<Geometry*> geometries;
+  std::vector<Light> lights_; //Point lights
+
+  glm::vec3 directional_dir_;
+  float directional_inrtensity_;
+  unsigned int light_samples_;
+  //Shadow rays fired before deciding if the point is in a penumbra
+  unsigned int light_probe_samples_;
+  float light_offset_;
+
+  //Render resolution passes run over square tiles in Morton order
+  unsigned int tile_size_;
+  //Order and split the tiles by how long they took in the last frame
+  bool cost_balancing_;
+  unsigned int num_bounces_;
+  SamplerType sampler_type_;
+
+  //Above this many point lights only many_lights_samples_ of them, picked
+  //through the light tree, are shaded per hit
+  unsigned int many_lights_threshold_;
+  unsigned int many_lights_samples_;
+
+  //Two passes: intersections into the G-buffer, then shading from it
+  bool deferred_shading_;
+
+  //Keep adding jittered samples to a float buffer while nothing changes
+  bool progressive_;
+
+  //When only the camera moves, reuse last frame's shaded pixels that still
+  //land on the same surface and trace the rest
+  bool temporal_reprojection_;
+  float reprojection_depth_tolerance_; //Relative to the pixel depth
+
+  //Trace half of the pixels each frame in a checkerboard, the other half
+  //comes from the last frame or from its traced neighbours. Works with
+  //forward and deferred shading.
+  bool checkerboard_;
+
+  //Fraction of the screen resolution that is traced, the result is
+  //upscaled to the screen. Any value in [min_render_scale_, 1].
+  float render_scale_;
+  float min_render_scale_;
+
+  //When upscaling, screen pixels next to a geometry, depth or luminance
+  //discontinuity are traced at full resolution instead of interpolated
+  bool edge_adaptive_upscale_;
+  float edge_luminance_threshold_;
+  float edge_depth_tolerance_; //Relative to the pixel depth
+
+  //Adjusts render_scale_ every frame to hold this frame time, 0 disables it
+  float target_frame_ms_;
+
+  //Conversion of the linear colors to the 8 bit output, see Tonemapper.
+  //The defaults are the plain clamp.
+  ToneCurve tone_curve_;
+  float exposure_;
+  bool srgb_output_;
+  bool dither_;
+};
+
+class Renderer : public RenderSettings {
 public:
 
   Renderer();
@@ -62,17 +184,92 @@ public:
 
   void Init(TScreen *screen);
 
+  //Renders a frame into screen_ and returns when it is done
   void Update();
 
+  //Pipelined frames. BeginFrame copies the settings and queues a frame
+  //that starts when the previous one is done. EndFrame waits for the
+  //frame frame_latency_ frames behind the last one queued and returns its
+  //image, nullptr while the pipeline fills up. The image stays valid until
+  //the next BeginFrame. Geometry objects are shared, not copied: edit them
+  //in place only after WaitIdle.
+  //What overlaps is the caller's work on frame N, uploading, presenting
+  //and input, with frame N+1 on the workers. The stages of two frames
+  //don't: N+1 only starts tracing once N is upscaled and tonemapped, they
+  //share the G-buffer and the pixel buffers. Inside a frame the upscale of
+  //a band already starts as soon as the tiles under it are done.
+  void BeginFrame();
+  //Same, but the frame is drawn straight into output, which EndFrame
+  //returns. The renderer doesn't touch it after that, so it can be handed
+  //to another thread without a copy.
+  void BeginFrame(TScreen* output);
+  const TScreen* EndFrame();
+  void WaitIdle();
+
   void Clean();
 
   void SetLightRotation(float X, float Y, float Z);
 
-  Camera camera_;
-  TScreen *screen_;
+  //Call after moving or editing geometries in place, changes to the
+  //geometries vector itself are detected
+  void MarkGeometryDirty();
 
-  std::vector<Geometry*> geometries;
-  std::vector<Light> lights_; //Later implemented
+  //See target_frame_ms_
+  void SetTargetFrameTime(float milliseconds);
+  float target_frame_time() const { return target_frame_ms_; }
+
+  //Stats of the frame EndFrame last returned, or of the last Update. The
+  //accessors below read the renderer itself, only once it is idle.
+  const FrameStats& frame_stats() const { return frame_stats_; }
+
+  unsigned int frame_changes() const { return frame_changes_; }
+  bool hits_reused() const { return hits_reused_; }
+  unsigned int accumulated_frames() const { return accumulated_frames_; }
+  unsigned int reused_pixels() const { return reused_pixels_; }
+  unsigned int edge_pixels() const { return edge_pixels_; }
+  //Partition used by the last frame, in claiming order, and the time of
+  //each tile summed over all its passes
+  const std::vector<WorkItem>& work_items() const { return work_items_; }
+  const std::vector<Tile>& tiles() const { return tiles_; }
+  const std::vector<float>& tile_times() const { return tile_ms_; }
+
+  TScreen *screen_;   //Output, full resolution
+
+  //Frames queued ahead of the one being presented by EndFrame. 0 renders
+  //and presents in lockstep, more keeps the workers busy on the next
+  //frames while the caller presents the last one, at the cost of that many
+  //frames of input lag. It doesn't make the frames themselves overlap.
+  unsigned int frame_latency_;
+
+  //Read by Init. 0 workers is one per logical processor. Pinned workers
+  //fill one NUMA node before the next, and take tiles from their node's
+  //part of the image first. The spare scheduler thread is pinned too, so
+  //pinned_workers() is one more than the workers when every pin works.
+  //The pixel buffers are first written by the worker that renders each
+  //tile and every node gets its own copy of the hit records, so with
+  //several nodes most of a worker's reads stay on its own memory.
+  unsigned int worker_threads_;
+  bool pin_workers_;
+  //Workers the scheduler got in Init, each pass runs one tile job per worker
+  unsigned int workers() const { return workers_; }
+  const CpuTopology& topology() const { return topology_; }
+  unsigned int pinned_workers() const { return pinned_workers_; }
+  //Scheduler jobs of the last frame and the time spent queuing them
+  unsigned int submitted_jobs() const { return submitted_jobs_; }
+  float submit_time() const { return submit_ms_; }
+  //Transient memory of the last frame, fallbacks are the allocations that
+  //didn't fit in the arena and went to malloc
+  size_t arena_bytes() const { return arena_bytes_; }
+  unsigned int arena_allocations() const { return arena_allocations_; }
+  unsigned int arena_fallbacks() const { return arena_fallbacks_; }
+  //The workers, to run other per frame work next to the frames
+  px_sched::Scheduler* scheduler() { return &schd; }
+  //Rays intersected with the scene in the last frame, shadow rays included
+  unsigned long long rays_traced() const { return frame_rays_; }
+
+  //Linear colors of the last frame at the render resolution, before the
+  //tonemap. Only once it is done, after Update or WaitIdle.
+  void GetLinearImage(std::vector<glm::vec3>* colors, unsigned int* width, unsigned int* height) const;
 
   glm::vec3 up = { 0.0f,1.0f,0.0 };
   glm::vec3 forward = { 0.0f,0.0f,-1.0f };
@@ -81,31 +278,229 @@ public:
   glm::vec3 horizontal;
   glm::vec3 vertical;
 
-  glm::vec3 directional_dir_;
-  float directional_inrtensity_;
-  unsigned int light_samples_;
-  float light_offset_;
+private:
+  struct FrameSlot {
+    Renderer* renderer;
+    RenderSettings settings;
+    bool geometry_dirty;
+    FirstTouchVector<unsigned int> pixels;
+    bool new_pixels; //Nothing wrote them yet
+    FrameStats stats;
+    TScreen output;
+    TScreen* target; //output or the caller's image
+    px_sched::Sync done;
+  };
 
-  unsigned int num_threads_;
-  unsigned int num_bounces_;
+  void RenderFrame(TScreen* output, bool new_output, FrameStats* stats);
 
-private:
-  glm::vec3 ComputeLighting(RayInfo ray);
+  //What a point light's shadow ray and shading need from a hit
+  struct PointLightSetup {
+    glm::vec3 to_light;
+    glm::vec3 dir;
+    float dist2;
+    float diffuse; //N.L, no shadow ray at 0 or below
+  };
+  //The same for a run of pixels of a G-buffer row and every point light,
+  //worked out 4 pixels at a time before any of their shadow rays
+  struct PointLightRun {
+    static const unsigned int kPixels = 16;
+    static const unsigned int kMaxLights = 8;
+    float to_x[kMaxLights][kPixels], to_y[kMaxLights][kPixels], to_z[kMaxLights][kPixels];
+    float dir_x[kMaxLights][kPixels], dir_y[kMaxLights][kPixels], dir_z[kMaxLights][kPixels];
+    float dist2[kMaxLights][kPixels];
+    float diffuse[kMaxLights][kPixels];
+  };
+  static void SetupPointLights(const GBufferLayer& layer, size_t first, unsigned int count,
+    const std::vector<Light>& lights, PointLightRun& run);
+
+  glm::vec3 ComputeLighting(RayInfo ray, Sampler& sampler);
+  //run has the point lights of the pixel already set up, nullptr if not
+  glm::vec3 ComputeLighting(RayInfo ray, Sampler& sampler, const PointLightRun* run, unsigned int pixel);
+  glm::vec3 ComputeLightSample(const RayInfo& info, const glm::vec3& light_dir, bool& lit, Sampler& sampler);
+  glm::vec3 SampleLightDir(glm::vec2 u);
+  glm::vec3 ComputePointLight(const RayInfo& info, const Light& light, Sampler& sampler);
+  glm::vec3 ShadePointLight(const RayInfo& info, const Light& light, const PointLightSetup& setup, Sampler& sampler);
+
+  unsigned int DetectChanges();
+  void SetupRenderTarget();
+  void UpdateRenderScale(float frame_ms);
+  void UpscaleStep(int startrow, int endrow, int thread);
+  void Reproject();
+  void PlanCheckerboard(bool reprojected);
+  unsigned int PinWorkers(unsigned int threads);
+  struct PinState {
+    Renderer* renderer;
+    const std::vector<unsigned int>* processors;
+    unsigned int threads;
+    std::atomic<unsigned int> started;
+    std::atomic<unsigned int> pinned;
+  };
+  static void PinJob(void* arg);
+  static void FrameJob(void* arg);
+  //Buffers allocated this frame, cleared by the first pass over each tile
+  enum FirstTouch {
+    kTouchAccumulation = 1 << 0,
+    kTouchGBuffer = 1 << 1,
+    kTouchHistory = 1 << 2,
+    kTouchTarget = 1 << 3,
+  };
+  void FirstTouchStep(const Tile& tile, unsigned int buffers);
+  //hit_records_ or the copy on the calling worker's node
+  const HitRecords& records() const;
+  const HitRecords* NodeRecords();
+  void BuildTiles();
+  void PartitionTiles();
+  void CollectTileTimes();
+  typedef void (Renderer::*TileStep)(const Tile&, int);
+  //Argument of a scheduler job. They come from the frame arena, so
+  //submitting a job never allocates.
+  struct RenderTask {
+    Renderer* renderer;
+    TileStep first;
+    TileStep second;
+    unsigned int index; //Worker or band
+    unsigned int first_touch;
+    bool tonemap;
+    bool feed_bands;
+  };
+  RenderTask* AcquireTask();
+  void Submit(void (*func)(void*), RenderTask* task, px_sched::Sync* trigger);
+  static void TileWorkerJob(void* arg);
+  static void EdgeMaskJob(void* arg);
+  static void UpscaleJob(void* arg);
+
+  void BuildBandGraph();
+  void FeedBands(const WorkItem& item);
+  void DispatchTiles(TileStep first, TileStep second);
+  void UpdateStep(const Tile& tile, int thread/*for tracing*/);
+  void TraceStep(const Tile& tile, int thread);
+  void ShadeStep(const Tile& tile, int thread);
+  void ReconstructStep(const Tile& tile, int thread);
+  void ReprojectClearStep(const Tile& tile, int thread);
+  void ReprojectScatterStep(const Tile& tile, int thread);
+  void ReprojectPlanStep(const Tile& tile, int thread);
+  void TonemapStep(const Tile& tile, int thread);
+  void EdgeMaskStep(int startrow, int endrow, int thread);
+  void EdgeTraceStep(int startrow, int endrow, int thread);
 
-  void UpdateStep(int startrow, int endrow,int thread/*for tracing*/);
+  Ray PrimaryRay(float x, float y);
+  Ray PrimaryRay(float x, float y, unsigned int width, unsigned int height);
+  glm::vec2 PixelJitter(Sampler& sampler);
+  void Accumulate(size_t index, glm::vec3 color);
+  static glm::vec3 Resolve(const glm::vec4& total);
   
-  RayInfo ComputeRay(Ray& ray, int depth);
+  RayInfo ComputeRay(Ray& ray, int depth, Sampler& sampler);
   //For faster compute
   float LengthSquared(glm::vec3 v);
-  float Rand();
-  float RandRange(float min,float max);
-  glm::vec3 RandVec(float lengthmin, float lengthmax);
 
-  glm::vec3 RandSphere();
+  static const unsigned int kMaxSchedulerTasks = 8192;
+  //Everything that only lives during a frame, reset when one starts
+  static const size_t kArenaRegionBytes = 256 * 1024;
+  FrameArena arena_;
+  size_t arena_bytes_;
+  unsigned int arena_allocations_;
+  unsigned int arena_fallbacks_;
+  std::atomic<unsigned long long> rays_traced_;
+  unsigned long long frame_rays_;
+  unsigned int submitted_jobs_;
+  float submit_ms_;
+  //Work items per NUMA node, [begin, end) in work_items_
+  static const unsigned int kMaxNodeQueues = 8;
+  unsigned int node_queues_;
+  unsigned int queue_begin_[kMaxNodeQueues];
+  unsigned int queue_end_[kMaxNodeQueues];
+  std::atomic<unsigned int> queue_next_[kMaxNodeQueues];
+  CpuTopology topology_;
+
+  //Upscale bands of the running frame, see BuildBandGraph
+  bool tonemap_tiles_;
+  bool feed_bands_;
+  unsigned int bands_;
+  px_sched::Sync* mask_ready_;
+  px_sched::Sync* upscale_ready_;
+  unsigned int* band_rows_; //First output row of each band
+  unsigned int workers_;
+  FrameStats frame_stats_;
+  unsigned int pinned_workers_;
+  unsigned int first_touch_;
+  std::vector<Tile> tiles_; //Morton order
+  std::vector<float> tile_ms_;
+  std::vector<WorkItem> work_items_;
+  std::vector<float> work_item_ms_;
+  unsigned int tiles_width_, tiles_height_, tiles_size_;
+
+  //Where the passes write, screen_ or render_target_ when scaled
+  static const unsigned int kPixelsPerCacheLine = 64 / sizeof(unsigned int);
+  TScreen* target_;
+  TScreen render_target_;
+  FirstTouchVector<unsigned int> render_pixels_;
+  Scaler scaler_;
+  Tonemapper tonemapper_;
+  std::vector<unsigned char> edge_mask_;
+  std::atomic<unsigned int> edge_pixels_;
+  float last_target_frame_ms_;
+  float frame_ms_average_;
+  unsigned int frames_under_budget_;
+
+  //Copy of the settings the running frame reads and its output
+  RenderSettings frame_;
+  bool frame_geometry_dirty_;
+  TScreen* output_;
+  std::atomic<float> adapted_render_scale_;
+
+  //Ring of frame_latency_ + 1 frames, used in submission order
+  std::vector<FrameSlot> slots_;
+  unsigned int frames_submitted_;
+  unsigned int frames_presented_;
+  px_sched::Sync last_frame_;
 
   px_sched::Scheduler schd;
   px_sched::Sync sync_obj;
-  std::vector<glm::vec3> directional_dir_samples_;
+  unsigned int frame_index_;
+  glm::vec3 light_dir_;
+  glm::vec3 light_tangent_;
+  glm::vec3 light_bitangent_;
+  //Geometry packed for intersection, rebuilt every frame
+  HitRecords hit_records_;
+  //Copies of it per node, made by the first worker of the node that traces
+  //in a frame. Until that one is done the others read hit_records_.
+  enum NodeRecordsState { kRecordsMissing, kRecordsBuilding, kRecordsReady };
+  bool replicate_records_;
+  HitRecords node_records_[kMaxNodeQueues];
+  std::atomic<unsigned int> node_records_state_[kMaxNodeQueues];
+  LightTree light_tree_;
+  GBuffer gbuffer_;
+  bool gbuffer_valid_;
+  bool gbuffer_complete_; //Every pixel was traced, not planned
+  bool hits_reused_;
+
+  //Sum of all the samples since the last change, count in w
+  FirstTouchVector<glm::vec4> accumulation_;
+  unsigned int accumulated_frames_;
+
+  //Temporal reprojection
+  static constexpr float kMaxHistorySamples = 8.0f;
+  GBuffer history_gbuffer_;
+  FirstTouchVector<glm::vec4> history_accumulation_;
+  //Nearest old hit of each pixel, see ReprojectKey. Allocated with the history.
+  FirstTouchVector<std::atomic<unsigned long long>> reproject_keys_;
+  std::vector<unsigned char> pixel_plan_;
+  bool use_pixel_plan_;
+  std::atomic<unsigned int> reused_pixels_;
+
+  //State of the last frame, to know what has to be traced again
+  unsigned int frame_changes_;
+  Camera last_camera_;
+  unsigned int last_num_bounces_;
+  unsigned int last_width_;
+  unsigned int last_height_;
+  std::vector<Geometry*> last_geometries_;
+  bool geometry_dirty_;
+  std::vector<Light> last_lights_;
+  glm::vec3 last_directional_dir_;
+  float last_directional_intensity_;
+  unsigned int last_light_samples_;
+  float last_light_offset_;
 };
 
 
@@ -0,0 +1,73 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#ifndef __SAMPLER_H__
+#define __SAMPLER_H__ 1
+
+#include "glm/glm.hpp"
+
+#include <stdint.h>
+
+//PCG32 (pcg-random.org), small and fast, one per task so nothing is shared
+struct Pcg32 {
+  uint64_t state = 0x853c49e6748fea9bULL;
+  uint64_t inc = 0xda3e39cb94b95bdbULL;
+
+  void Seed(uint64_t seed, uint64_t sequence);
+  uint32_t Next();
+  float NextFloat();
+};
+
+//Dimension reserved for the sub pixel jitter, far from the ones handed out
+//by NextDimension so they never overlap
+static const unsigned int kPixelJitterDimension = 0xffff;
+
+enum SamplerType {
+  kSamplerRandom = 0,  //PCG32 only
+  kSamplerSobol,       //Owen scrambled Sobol (0,2) sequence
+  kSamplerBlueNoise,   //Blue noise mask per pixel + R2 sequence per sample
+  kSamplerCount
+};
+
+//Per pixel and per sample point generator. Every pixel sample is split in
+//dimensions (one per random decision: light disk, jitter...), the sequences
+//are indexed by (pixel, dimension, index) so they don't need any shared state.
+class Sampler {
+public:
+  Sampler();
+
+  void Init(SamplerType type, uint64_t seed, uint64_t stream);
+
+  void StartPixel(unsigned int x, unsigned int y, unsigned int sample_index);
+
+  //Reserves a new dimension pair for the current pixel sample
+  unsigned int NextDimension() { return dimension_++; }
+
+  //index-th point of the sequence on a dimension pair. Consecutive power of
+  //two blocks of indices are stratified for the low discrepancy samplers.
+  glm::vec2 Get2D(unsigned int dimension, unsigned int index);
+
+  glm::vec2 Next2D() { return Get2D(NextDimension(), sample_index_); }
+
+  unsigned int sample_index() const { return sample_index_; }
+
+  Pcg32 rng_;
+
+private:
+  SamplerType type_;
+  uint32_t pixel_seed_;
+  unsigned int pixel_x_, pixel_y_;
+  unsigned int sample_index_;
+  unsigned int dimension_;
+};
+
+//Maps the unit square to the unit disk keeping the stratification
+glm::vec2 ConcentricDisk(glm::vec2 u);
+
+#endif //__SAMPLER_H__
@@ -0,0 +1,53 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#ifndef __SCALER_H__
+#define __SCALER_H__ 1
+
+#include <vector>
+
+struct TScreen;
+
+//Bilinear ARGB scaler for any ratio. The source position of every output
+//row and column is stepped once in 16.16 fixed point by Setup, ScaleRows
+//only reads the tables so it can be split by rows across threads. The rows
+//run 4 pixels at a time with SSE2, 8 with AVX2 when the build targets it.
+class Scaler {
+public:
+  //Weights are 7 bit so the SIMD lerp fits in signed 16 bit lanes
+  static const int kWeightBits = 7;
+
+  //Does nothing if the sizes didn't change
+  void Setup(unsigned int src_width, unsigned int src_height,
+    unsigned int dst_width, unsigned int dst_height);
+
+  //scratch holds a source row, one per thread
+  void ScaleRows(const TScreen& src, TScreen& dst, unsigned int startrow, unsigned int endrow,
+    unsigned int* scratch) const;
+
+  //Source texels of the 2x2 footprint of an output pixel
+  unsigned int source_column(unsigned int x) const { return column_[x]; }
+  unsigned int source_column_next(unsigned int x) const { return column_next_[x]; }
+  unsigned int source_row(unsigned int y) const { return row_[y]; }
+  unsigned int source_row_next(unsigned int y) const { return row_next_[y]; }
+
+private:
+  unsigned int src_width_ = 0, src_height_ = 0;
+  unsigned int dst_width_ = 0, dst_height_ = 0;
+
+  std::vector<unsigned int> column_;
+  std::vector<unsigned int> column_next_;
+  //Weight repeated for the 4 channels, ready to be loaded as 16 bit lanes
+  std::vector<unsigned long long> column_weight_;
+  std::vector<unsigned int> row_;
+  std::vector<unsigned int> row_next_;
+  std::vector<unsigned int> row_weight_;
+};
+
+#endif
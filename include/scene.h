@@ -0,0 +1,42 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#ifndef __SCENE_H__
+#define __SCENE_H__ 1
+
+#include "renderer.h"
+#include "geometry.h"
+
+enum DemoSceneId {
+  kSceneBase = 0,  //Spheres over the floor
+  kSceneObjs,      //Two cubes and the teapot
+  kSceneCount,
+};
+
+//Objects of the demo scenes, shared by the window and headless builds
+struct DemoScene {
+  Sphere sphere1_;
+  Sphere sphere2_;
+  Sphere sphere3_;
+  Sphere sphere4_;
+  Plane floor_;
+  CustomGeometry cube_;
+  CustomGeometry cube2_;
+  CustomGeometry teapot_;
+  Light light1_;
+};
+
+//Camera, lights and objects of every scene, the meshes are loaded from
+//data_path. The renderer starts with the base scene.
+void PrepareDemoScene(DemoScene* scene, Renderer* renderer, const char* data_path);
+
+//Replaces the renderer's geometries with the ones of a scene
+void UseDemoScene(DemoScene* scene, Renderer* renderer, DemoSceneId id);
+
+#endif
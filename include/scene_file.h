@@ -0,0 +1,47 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#ifndef __SCENE_FILE_H__
+#define __SCENE_FILE_H__ 1
+
+#include <string>
+#include <vector>
+
+#include "renderer.h"
+#include "geometry.h"
+
+//Text scenes, one object per line and # for comments:
+//
+//  camera <x y z> <focal length> <v> [u]    Sizes of the image plane
+//  sun <x y z>                  Rotation of the directional light, radians
+//  light <x y z> <r g b> <intensity>
+//  material <name> <r g b> <diffuse> <specular>
+//  sphere <material> <x y z> <radius>
+//  plane <material> <x y z> <normal x y z>   Through x y z
+//  mesh <material> <file.obj> <x y z> [rotate <x y z>] [scale <s> | <x y z>]
+//
+//Materials are defined before the objects that use them. Without u the
+//camera keeps the aspect ratio it had. Mesh paths are relative to the
+//scene file, rotations are in degrees. Each obj is loaded once, on its own
+//thread, however many meshes use it.
+struct SceneFile {
+  std::vector<Sphere> spheres_;
+  std::vector<Plane> planes_;
+  std::vector<CustomGeometry> meshes_;
+  unsigned int mesh_files_;
+};
+
+//Replaces scene and the renderer's camera, lights and geometries, which
+//point into it. The file is loaded completely before any of them changes:
+//on an error it prints the line of the first one and returns false with
+//the scene and the renderer untouched, so the last scene keeps rendering.
+//Frames in flight read the scene, wait for them first.
+bool LoadSceneFile(const char* path, SceneFile* scene, Renderer* renderer);
+
+#endif
@@ -0,0 +1,48 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#ifndef __TONEMAP_H__
+#define __TONEMAP_H__ 1
+
+#include "glm/glm.hpp"
+
+enum ToneCurve {
+  kToneClamp = 0, //Linear, clipped at 1
+  kToneReinhard,  //x / (1 + x)
+  kToneFilmic,    //Fit of the ACES curve
+  kToneCurveCount,
+};
+
+//Turns linear float colors into ARGB8888 pixels: exposure, tone curve,
+//sRGB encode through a table and ordered dither. Without sRGB and dither
+//a channel is truncated to 8 bits exactly like the renderer always did.
+class Tonemapper {
+public:
+  Tonemapper();
+
+  void Setup(ToneCurve curve, float exposure, bool srgb, bool dither);
+
+  //colors are sums of samples with their count in w, a w of 0 is a single
+  //color. x and y place the row on the screen for the dither pattern.
+  void ConvertRow(const glm::vec4* colors, unsigned int* out, unsigned int count,
+    unsigned int x, unsigned int y) const;
+  unsigned int ConvertPixel(const glm::vec3& color, unsigned int x, unsigned int y) const;
+
+private:
+  //Encoded values in 1/16ths of a level, the dither adds to the fraction
+  static const int kLutBits = 12;
+  unsigned short srgb_lut_[1 << kLutBits];
+
+  ToneCurve curve_;
+  float exposure_;
+  bool srgb_;
+  bool dither_;
+};
+
+#endif
@@ -0,0 +1,60 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#ifndef __TOPOLOGY_H__
+#define __TOPOLOGY_H__ 1
+
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+//Logical processors of the machine and the NUMA node each one belongs to
+struct CpuTopology {
+  unsigned int logical_processors = 1;
+  unsigned int numa_nodes = 1;
+  std::vector<unsigned int> processor_node;
+};
+
+CpuTopology DetectTopology();
+
+void PrintTopology(const CpuTopology& topology);
+
+//Pins the calling thread to one logical processor. Returns false if the
+//OS refused, the thread then runs anywhere.
+bool PinCurrentThread(unsigned int processor, unsigned int node);
+
+//Node the calling thread was pinned to, -1 if it wasn't
+int CurrentThreadNode();
+
+//Leaves new elements of plain types uninitialized. A fresh buffer then has
+//no page written yet and the OS places each page on the node of the
+//thread that writes it first, so whoever works on a part of the buffer
+//can be the one that clears it.
+template <typename T>
+struct FirstTouchAllocator : std::allocator<T> {
+  template <typename U> struct rebind { typedef FirstTouchAllocator<U> other; };
+  FirstTouchAllocator() = default;
+  template <typename U> FirstTouchAllocator(const FirstTouchAllocator<U>&) {}
+
+  template <typename U> void construct(U* ptr) { ::new ((void*)ptr) U; }
+  template <typename U, typename... Args> void construct(U* ptr, Args&&... args) {
+    ::new ((void*)ptr) U(std::forward<Args>(args)...);
+  }
+};
+template <typename T> using FirstTouchVector = std::vector<T, FirstTouchAllocator<T>>;
+
+//New storage of count elements, none of them written. Resizing in place
+//would copy the old elements on the calling thread.
+template <typename T>
+void ReallocateUntouched(FirstTouchVector<T>& buffer, size_t count) {
+  FirstTouchVector<T>(count).swap(buffer);
+}
+
+#endif
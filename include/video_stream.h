@@ -0,0 +1,73 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#ifndef __VIDEO_STREAM_H__
+#define __VIDEO_STREAM_H__ 1
+
+#include <stdio.h>
+#include <vector>
+
+#include "job.h"
+
+struct TScreen;
+
+enum VideoFormat {
+  kVideoRGB24, //Packed 8 bit RGB, no header
+  kVideoY4M,   //YUV4MPEG2, 4:2:0 BT.601 studio range
+};
+
+//Raw video for an external encoder, e.g.
+//  HeadlessTracer --stream y4m --animate 120 | ffmpeg -i - out.mp4
+//Each frame is converted in bands of rows run as jobs on the renderer's
+//workers, then written in one go.
+class VideoStream {
+public:
+  VideoStream();
+  ~VideoStream();
+  VideoStream(const VideoStream&) = delete;
+  VideoStream& operator=(const VideoStream&) = delete;
+
+  //"-" writes to stdout, anything else is opened as a file, which can be a
+  //named pipe. Y4M needs an even width and height. The scheduler is only
+  //used by WriteFrame.
+  bool Open(const char* path, VideoFormat format, unsigned int width, unsigned int height,
+    unsigned int fps, px_sched::Scheduler* schd);
+  //false once the stream can't be written, e.g. the reader went away
+  bool WriteFrame(const TScreen& frame);
+  void Close();
+
+  unsigned int frames() const { return frames_; }
+  //From queuing the bands until they are all done, the workers may still
+  //be busy with a frame
+  float convert_time() const { return convert_ms_; }
+  float write_time() const { return write_ms_; }
+
+private:
+  static const unsigned int kRowsPerBand = 16;
+  struct Band {
+    VideoStream* stream;
+    unsigned int start, end;
+  };
+  static void ConvertJob(void* arg);
+
+  FILE* file_;
+  VideoFormat format_;
+  unsigned int width_, height_;
+  px_sched::Scheduler* schd_;
+  //Frame being converted, only during WriteFrame
+  const TScreen* frame_;
+  std::vector<Band> bands_;
+  std::vector<unsigned char> buffer_;
+
+  unsigned int frames_;
+  float convert_ms_;
+  float write_ms_;
+};
+
+#endif
@@ -1,4 +1,9 @@
 
+newoption {
+  trigger = "avx2",
+  description = "Build the AVX2 paths, the binary then needs a processor that has it"
+}
+
 solution ("RayTracer" .. _ACTION)
 	configurations { "Debug", "Release" }
 	platforms { "x32", "x64" }
@@ -43,6 +48,12 @@ solution ("RayTracer" .. _ACTION)
     links{
       "./deps/lib/x86/*"
     }
+
+  configuration { "avx2", "vs*" }
+    buildoptions { "/arch:AVX2" }
+
+  configuration { "avx2", "not vs*" }
+    buildoptions { "-mavx2" }
   
 
   project "RecursiveTracer"
@@ -59,5 +70,49 @@ solution ("RayTracer" .. _ACTION)
 
 
   }
+  excludes { "./src/headless_main.cc" }
+
+
+  project "HeadlessTracer"
+  kind "ConsoleApp"
+	targetname ("HeadlessTracer")
+	language "C++"
+  location ("./build/HeadlessTracer/" .. _ACTION)
+
+  defines { "_CRT_SECURE_NO_WARNINGS", "MTR_ENABLED" }
+  flags { "ExtraWarnings" }
+
+  files {
+    "./deps/glm/**.h",
+    "./deps/glm/**.inl",
+    "./deps/px_sched.h",
+    "./deps/minitrace.h",
+    "./deps/minitrace.c",
+    "./deps/tiny_obj_loader.h",
+    "./src/*.cc",
+    "./include/*.h"
+  }
+  excludes { "./src/main.cc" }
+
+  configuration "linux"
+    links { "pthread" }
+
+  configuration "Debug"
+    defines { "DEBUG" }
+    targetdir ("bin/Debug")
+    targetsuffix "_d"
+    objdir ("build/HeadlessTracer/Debug")
+    flags { "Symbols", "NoPCH" }
+
+  configuration "Release"
+    targetdir ("bin/Release")
+    objdir ("build/HeadlessTracer/Release")
+    flags { "Optimize", "NoPCH" }
+
+  configuration { "avx2", "vs*" }
+    buildoptions { "/arch:AVX2" }
+
+  configuration { "avx2", "not vs*" }
+    buildoptions { "-mavx2" }
 
 
@@ -0,0 +1,127 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#include "arena.h"
+
+#include <stdlib.h>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+static void* AlignedAlloc(size_t bytes) { return _aligned_malloc(bytes, FrameArena::kAlignment); }
+static void AlignedFree(void* ptr) { _aligned_free(ptr); }
+#else
+static void* AlignedAlloc(size_t bytes) {
+  void* ptr = nullptr;
+  return posix_memalign(&ptr, FrameArena::kAlignment, bytes) == 0 ? ptr : nullptr;
+}
+static void AlignedFree(void* ptr) { free(ptr); }
+#endif
+
+//Threads get a slot the first time they allocate, the same one for the
+//rest of their life
+static std::atomic<unsigned int> g_next_thread_slot(0);
+static thread_local unsigned int t_thread_slot = ~0u;
+
+static size_t RoundUp(size_t bytes, size_t to) {
+  return (bytes + to - 1) / to * to;
+}
+
+FrameArena::~FrameArena(){
+  Release();
+}
+
+void FrameArena::Release(){
+  Reset();
+  for (unsigned int i = 0; i < region_count_; ++i) {
+    AlignedFree(regions_[i].base);
+    regions_[i].~Region();
+  }
+  AlignedFree(regions_);
+  regions_ = nullptr;
+  region_count_ = 0;
+}
+
+void FrameArena::Init(unsigned int regions, size_t region_bytes){
+  Release();
+
+  //Aligned by hand, new doesn't have to honor alignas before C++17
+  region_count_ = regions > 0 ? regions : 1;
+  regions_ = (Region*)AlignedAlloc(sizeof(Region) * region_count_);
+  for (unsigned int i = 0; i < region_count_; ++i) {
+    new (&regions_[i]) Region();
+    regions_[i].size = RoundUp(region_bytes, kAlignment);
+    regions_[i].base = (unsigned char*)AlignedAlloc(regions_[i].size);
+    regions_[i].used = 0;
+  }
+}
+
+void FrameArena::Reset(){
+  for (size_t i = 0; i < fallback_blocks_.size(); ++i) {
+    AlignedFree(fallback_blocks_[i]);
+  }
+  fallback_blocks_.clear();
+
+  for (unsigned int i = 0; i < region_count_; ++i) {
+    Region& region = regions_[i];
+    if (region.used > region.size) {
+      //Some headroom so a slightly bigger frame still fits
+      size_t size = RoundUp(region.used + region.used / 4, 64 * 1024);
+      AlignedFree(region.base);
+      region.base = (unsigned char*)AlignedAlloc(size);
+      region.size = size;
+    }
+    region.used = 0;
+  }
+  bytes_ = 0;
+  allocations_ = 0;
+  fallbacks_ = 0;
+}
+
+void* FrameArena::Allocate(size_t bytes){
+  bytes = RoundUp(bytes > 0 ? bytes : 1, kAlignment);
+  allocations_.fetch_add(1, std::memory_order_relaxed);
+  bytes_.fetch_add(bytes, std::memory_order_relaxed);
+
+  if (t_thread_slot == ~0u) t_thread_slot = g_next_thread_slot.fetch_add(1);
+  if (region_count_ > 0) {
+    //Regions are shared when there are more threads, so the bump is atomic
+    Region& region = regions_[t_thread_slot % region_count_];
+    size_t offset = region.used.fetch_add(bytes, std::memory_order_relaxed);
+    if (offset + bytes <= region.size) return region.base + offset;
+  }
+
+  fallbacks_.fetch_add(1, std::memory_order_relaxed);
+  void* block = AlignedAlloc(bytes);
+  std::lock_guard<std::mutex> lock(fallback_mutex_);
+  fallback_blocks_.push_back(block);
+  return block;
+}
+
+static std::atomic<size_t> g_scheduler_bytes(0);
+
+void* FrameArena::SchedulerAlloc(size_t bytes){
+  //Size kept in front of the block, free only gets the pointer
+  size_t* block = (size_t*)AlignedAlloc(bytes + kAlignment);
+  if (!block) return nullptr;
+  *block = bytes;
+  g_scheduler_bytes += bytes;
+  return (unsigned char*)block + kAlignment;
+}
+
+void FrameArena::SchedulerFree(void* ptr){
+  if (!ptr) return;
+  size_t* block = (size_t*)((unsigned char*)ptr - kAlignment);
+  g_scheduler_bytes -= *block;
+  AlignedFree(block);
+}
+
+size_t FrameArena::scheduler_bytes(){
+  return g_scheduler_bytes;
+}
@@ -0,0 +1,118 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#include "frame_writer.h"
+#include "image_io.h"
+
+#include <chrono>
+#include <stdio.h>
+
+FrameWriter::FrameWriter(){
+  writing_ = false;
+  quit_ = false;
+  frames_written_ = 0;
+  failed_writes_ = 0;
+  write_ms_ = 0.0f;
+  stall_ms_ = 0.0f;
+}
+
+FrameWriter::~FrameWriter(){
+  Shutdown();
+}
+
+void FrameWriter::Init(unsigned int width, unsigned int height, unsigned int buffers){
+  Shutdown();
+
+  buffers_.clear();
+  buffers_.resize(buffers > 0 ? buffers : 1);
+  free_.clear();
+  for (Buffer& buffer : buffers_) {
+    buffer.pixels.resize((size_t)width * height);
+    buffer.image.width = width;
+    buffer.image.height = height;
+    buffer.image.stride = width;
+    buffer.image.pixels = buffer.pixels.data();
+    free_.push_back(&buffer);
+  }
+  quit_ = false;
+  thread_ = std::thread(&FrameWriter::WriterLoop, this);
+}
+
+void FrameWriter::Shutdown(){
+  if (!thread_.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  work_ready_.notify_one();
+  thread_.join();
+}
+
+TScreen* FrameWriter::Acquire(){
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (free_.empty()) {
+    auto start = std::chrono::high_resolution_clock::now();
+    buffer_free_.wait(lock, [this] { return !free_.empty(); });
+    std::chrono::duration<float, std::milli> waited = std::chrono::high_resolution_clock::now() - start;
+    stall_ms_ += waited.count();
+  }
+  Buffer* buffer = free_.back();
+  free_.pop_back();
+  return &buffer->image;
+}
+
+void FrameWriter::Submit(const TScreen* frame, const std::string& path){
+  Buffer* buffer = Find(frame);
+  if (!buffer) return;
+  buffer->path = path;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(buffer);
+  }
+  work_ready_.notify_one();
+}
+
+void FrameWriter::Flush(){
+  std::unique_lock<std::mutex> lock(mutex_);
+  buffer_free_.wait(lock, [this] { return queue_.empty() && !writing_; });
+}
+
+FrameWriter::Buffer* FrameWriter::Find(const TScreen* frame){
+  for (Buffer& buffer : buffers_) {
+    if (&buffer.image == frame) return &buffer;
+  }
+  return nullptr;
+}
+
+void FrameWriter::WriterLoop(){
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    work_ready_.wait(lock, [this] { return quit_ || !queue_.empty(); });
+    //Everything queued is written before quitting
+    if (queue_.empty()) break;
+    Buffer* buffer = queue_.front();
+    queue_.pop_front();
+    writing_ = true;
+    lock.unlock();
+
+    auto start = std::chrono::high_resolution_clock::now();
+    bool written = WriteImage(buffer->path.c_str(), buffer->image);
+    std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+    if (!written) printf("Can't write %s\n", buffer->path.c_str());
+
+    lock.lock();
+    writing_ = false;
+    write_ms_ += elapsed.count();
+    if (written) frames_written_++;
+    else failed_writes_++;
+    free_.push_back(buffer);
+    //Acquire and Flush both wait on it
+    buffer_free_.notify_all();
+  }
+}
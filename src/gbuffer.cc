@@ -0,0 +1,85 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#include "gbuffer.h"
+#include "renderer.h"
+
+void GBufferLayer::Resize(size_t count){
+  ReallocateUntouched(pos_x, count);
+  ReallocateUntouched(pos_y, count);
+  ReallocateUntouched(pos_z, count);
+  ReallocateUntouched(normal_x, count);
+  ReallocateUntouched(normal_y, count);
+  ReallocateUntouched(normal_z, count);
+  ReallocateUntouched(depth, count);
+  ReallocateUntouched(geometry_index, count);
+}
+
+void GBufferLayer::Clear(size_t begin, size_t end){
+  std::fill(pos_x.begin() + begin, pos_x.begin() + end, 0.0f);
+  std::fill(pos_y.begin() + begin, pos_y.begin() + end, 0.0f);
+  std::fill(pos_z.begin() + begin, pos_z.begin() + end, 0.0f);
+  std::fill(normal_x.begin() + begin, normal_x.begin() + end, 0.0f);
+  std::fill(normal_y.begin() + begin, normal_y.begin() + end, 0.0f);
+  std::fill(normal_z.begin() + begin, normal_z.begin() + end, 0.0f);
+  std::fill(depth.begin() + begin, depth.begin() + end, -1.0f);
+  std::fill(geometry_index.begin() + begin, geometry_index.begin() + end, -1);
+}
+
+void GBufferLayer::Store(size_t index, const RayInfo& info){
+  if (info.dist == -1) {
+    depth[index] = -1.0f;
+    geometry_index[index] = -1;
+    return;
+  }
+
+  pos_x[index] = info.pos.x;
+  pos_y[index] = info.pos.y;
+  pos_z[index] = info.pos.z;
+  normal_x[index] = info.normal.x;
+  normal_y[index] = info.normal.y;
+  normal_z[index] = info.normal.z;
+  depth[index] = info.dist;
+  geometry_index[index] = info.geometry_index_;
+}
+
+bool GBufferLayer::Load(size_t index, RayInfo& info) const{
+  info.dist = depth[index];
+  if (info.dist == -1.0f) return false;
+
+  info.pos = glm::vec3(pos_x[index], pos_y[index], pos_z[index]);
+  info.normal = glm::vec3(normal_x[index], normal_y[index], normal_z[index]);
+  info.geometry_index_ = geometry_index[index];
+  return true;
+}
+
+void GBufferLayer::Copy(size_t index, const GBufferLayer& from, size_t from_index){
+  pos_x[index] = from.pos_x[from_index];
+  pos_y[index] = from.pos_y[from_index];
+  pos_z[index] = from.pos_z[from_index];
+  normal_x[index] = from.normal_x[from_index];
+  normal_y[index] = from.normal_y[from_index];
+  normal_z[index] = from.normal_z[from_index];
+  depth[index] = from.depth[from_index];
+  geometry_index[index] = from.geometry_index[from_index];
+}
+
+void GBuffer::Resize(unsigned int w, unsigned int h){
+  width = w;
+  height = h;
+  primary.Resize((size_t)w * h);
+  reflection.Resize((size_t)w * h);
+  ReallocateUntouched(reconstructed, (size_t)w * h);
+}
+
+void GBuffer::Clear(size_t begin, size_t end){
+  primary.Clear(begin, end);
+  reflection.Clear(begin, end);
+  std::fill(reconstructed.begin() + begin, reconstructed.begin() + end, 0);
+}
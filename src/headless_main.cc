@@ -0,0 +1,319 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+//Renders without a window and writes the image to a file, for batch
+//renders and measuring throughput. With --animate it renders a sequence
+//while a FrameWriter thread writes the finished frames, with --stream the
+//sequence goes out as raw video.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "renderer.h"
+#include "scene.h"
+#include "scene_file.h"
+#include "image_io.h"
+#include "frame_writer.h"
+#include "video_stream.h"
+
+#define PX_SCHED_IMPLEMENTATION
+#include "px_sched.h"
+
+struct HeadlessOptions {
+  unsigned int width = 1280;
+  unsigned int height = 720;
+  unsigned int frames = 1;
+  unsigned int samples = 8;
+  unsigned int threads = 0;
+  unsigned int animate = 0;
+  unsigned int queue = 4;
+  bool stream = false;
+  VideoFormat stream_format = kVideoY4M;
+  unsigned int fps = 30;
+  DemoSceneId scene = kSceneBase;
+  std::string scene_file;
+  float scale = 1.0f;
+  bool deferred = false;
+  bool pin = false;
+  std::string output; //render.ppm, or stdout when streaming
+  std::string data = "../../data";
+};
+
+static void PrintUsage() {
+  printf(R"STR(Usage: HeadlessTracer [options]
+  --width N         Image width (1280)
+  --height N        Image height (720)
+  --frames N        Frames rendered, each one adds a jittered sample per
+                    pixel to the image (1)
+  --samples N       Soft shadow samples per hit (8)
+  --threads N       Worker threads, 0 for every logical processor (0)
+  --scene NAME      base, objs or a .scene file (base)
+  --scale F         Render scale, upscaled to the image size (1.0)
+  --deferred        G-buffer pass, then shading
+  --pin             Pin the scheduler threads to processors
+  --data DIR        Folder with the obj files (../../data)
+  --output FILE     .ppm, .png or .pfm (render.ppm). PFM is the linear
+                    color before the tonemap, at the render resolution.
+  --animate N       Renders N frames with the light doing a full turn,
+                    written as FILE_0000.ext and on (.ppm or .png)
+  --queue N         Frames waiting to be written before the renderer
+                    waits for the disk, with --animate (4)
+  --stream FORMAT   rgb or y4m, writes the --animate frames (or just one)
+                    as raw video to FILE, stdout by default or with -
+  --fps N           Frame rate in the Y4M header (30)
+)STR");
+}
+
+static bool ParseOptions(int argc, char** argv, HeadlessOptions* options) {
+  for (int i = 1; i < argc; ++i) {
+    const char* option = argv[i];
+    //Options with a value
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    bool has_value = true;
+    if (!strcmp(option, "--width") && value) options->width = atoi(value);
+    else if (!strcmp(option, "--height") && value) options->height = atoi(value);
+    else if (!strcmp(option, "--frames") && value) options->frames = atoi(value);
+    else if (!strcmp(option, "--samples") && value) options->samples = atoi(value);
+    else if (!strcmp(option, "--threads") && value) options->threads = atoi(value);
+    else if (!strcmp(option, "--animate") && value) options->animate = atoi(value);
+    else if (!strcmp(option, "--queue") && value) options->queue = atoi(value);
+    else if (!strcmp(option, "--fps") && value) options->fps = atoi(value);
+    else if (!strcmp(option, "--stream") && value) {
+      options->stream = true;
+      if (!strcmp(value, "rgb")) options->stream_format = kVideoRGB24;
+      else if (!strcmp(value, "y4m")) options->stream_format = kVideoY4M;
+      else {
+        printf("Unknown stream format %s\n", value);
+        return false;
+      }
+    }
+    else if (!strcmp(option, "--scale") && value) options->scale = (float)atof(value);
+    else if (!strcmp(option, "--data") && value) options->data = value;
+    else if (!strcmp(option, "--output") && value) options->output = value;
+    else if (!strcmp(option, "--scene") && value) {
+      if (!strcmp(value, "base")) options->scene = kSceneBase;
+      else if (!strcmp(value, "objs")) options->scene = kSceneObjs;
+      else options->scene_file = value;
+    } else {
+      has_value = false;
+      if (!strcmp(option, "--deferred")) options->deferred = true;
+      else if (!strcmp(option, "--pin")) options->pin = true;
+      else if (!strcmp(option, "--help")) return false;
+      else {
+        printf("Unknown option %s\n", option);
+        return false;
+      }
+    }
+    if (has_value) i++;
+  }
+  if (options->width == 0 || options->height == 0 || options->frames == 0) {
+    printf("Width, height and frames have to be at least 1\n");
+    return false;
+  }
+  if ((options->animate > 0 || options->stream) && options->frames > 1) {
+    printf("--frames adds up samples of a still image, it can't be used with --animate or --stream\n");
+    return false;
+  }
+  if (options->output.empty()) options->output = options->stream ? "-" : "render.ppm";
+  return true;
+}
+
+static bool EndsWith(const std::string& text, const char* suffix) {
+  size_t length = strlen(suffix);
+  return text.size() >= length && text.compare(text.size() - length, length, suffix) == 0;
+}
+
+//render.png -> render_0012.png
+static std::string FramePath(const std::string& output, unsigned int frame) {
+  size_t dot = output.find_last_of('.');
+  size_t slash = output.find_last_of("/\\");
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) dot = output.size();
+  char number[16];
+  snprintf(number, sizeof(number), "_%04u", frame);
+  return output.substr(0, dot) + number + output.substr(dot);
+}
+
+static void AnimateLight(Renderer* renderer, unsigned int frame, unsigned int frames) {
+  renderer->SetLightRotation(-0.4f, 6.2831853f * frame / frames, 0.0f);
+}
+
+//Frames go through the pipeline straight into the writer's buffers, the
+//image of frame N is encoded while frame N + 1 is traced
+static int RenderAnimation(Renderer* renderer, const HeadlessOptions& options) {
+  if (EndsWith(options.output, ".pfm")) {
+    printf("--animate writes .ppm or .png\n");
+    return 1;
+  }
+  //The frames in flight in the renderer hold a buffer each too
+  renderer->frame_latency_ = 1;
+  FrameWriter writer;
+  writer.Init(options.width, options.height, options.queue + renderer->frame_latency_ + 1);
+
+  unsigned int presented = 0;
+  auto start = std::chrono::high_resolution_clock::now();
+  for (unsigned int frame = 0; frame < options.animate; ++frame) {
+    AnimateLight(renderer, frame, options.animate);
+    renderer->BeginFrame(writer.Acquire());
+    const TScreen* image = renderer->EndFrame();
+    if (image) writer.Submit(image, FramePath(options.output, presented++));
+  }
+  //With no latency EndFrame returns the frames still in flight
+  renderer->frame_latency_ = 0;
+  while (const TScreen* image = renderer->EndFrame()) {
+    writer.Submit(image, FramePath(options.output, presented++));
+  }
+  std::chrono::duration<double, std::milli> rendered = std::chrono::high_resolution_clock::now() - start;
+  writer.Flush();
+  std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+  printf("Rendered %u frames in %.1f ms, %.2f ms per frame\n", options.animate, rendered.count(),
+    rendered.count() / options.animate);
+  printf("Written in %.1f ms on the writer thread, renderer waited %.1f ms for it\n",
+    writer.write_time(), writer.stall_time());
+  printf("Done in %.1f ms, %u frames written\n", elapsed.count(), writer.frames_written());
+  return writer.failed_writes() == 0 ? 0 : 1;
+}
+
+//Frame N is converted and written while frame N + 1 is traced, the
+//conversion shares the workers with it
+static int RenderStream(Renderer* renderer, VideoStream& stream, const HeadlessOptions& options) {
+  unsigned int frames = options.animate > 0 ? options.animate : 1;
+  renderer->frame_latency_ = 1;
+
+  bool streaming = true;
+  auto start = std::chrono::high_resolution_clock::now();
+  for (unsigned int frame = 0; frame < frames && streaming; ++frame) {
+    AnimateLight(renderer, frame, frames);
+    renderer->BeginFrame();
+    const TScreen* image = renderer->EndFrame();
+    if (image) streaming = stream.WriteFrame(*image);
+  }
+  renderer->frame_latency_ = 0;
+  while (const TScreen* image = renderer->EndFrame()) {
+    if (streaming) streaming = stream.WriteFrame(*image);
+  }
+  std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+  stream.Close();
+
+  //stdout is stderr by now, the stream has the real one
+  printf("Streamed %u frames in %.1f ms, %.2f ms per frame\n", stream.frames(), elapsed.count(),
+    elapsed.count() / frames);
+  printf("Converted in %.1f ms, written in %.1f ms\n", stream.convert_time(), stream.write_time());
+  if (!streaming) printf("The stream was closed after %u frames\n", stream.frames());
+  return streaming ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+  HeadlessOptions options;
+  if (!ParseOptions(argc, argv, &options)) {
+    PrintUsage();
+    return 1;
+  }
+
+  std::vector<unsigned int> pixels((size_t)options.width * options.height);
+  TScreen screen;
+  screen.pixels = &pixels[0];
+  screen.width = options.width;
+  screen.height = options.height;
+  screen.stride = options.width;
+
+  //Scene and renderer are big, they don't go on the stack
+  DemoScene* scene = new DemoScene();
+  Renderer* renderer = new Renderer();
+  //Opened first, so nothing printed while loading ends up in the stream
+  VideoStream stream;
+  if (options.stream && !stream.Open(options.output.c_str(), options.stream_format,
+    options.width, options.height, options.fps, renderer->scheduler())) {
+    printf("Can't open %s\n", options.output.c_str());
+    delete renderer;
+    delete scene;
+    return 1;
+  }
+  SceneFile* scene_file = new SceneFile();
+  renderer->SetLightRotation(-0.4f, 0.0f, 0.0f);
+  if (options.scene_file.empty()) {
+    PrepareDemoScene(scene, renderer, options.data.c_str());
+    UseDemoScene(scene, renderer, options.scene);
+  } else {
+    auto load_start = std::chrono::high_resolution_clock::now();
+    if (!LoadSceneFile(options.scene_file.c_str(), scene_file, renderer)) {
+      delete scene_file;
+      delete renderer;
+      delete scene;
+      return 1;
+    }
+    std::chrono::duration<double, std::milli> load_time = std::chrono::high_resolution_clock::now() - load_start;
+    printf("%s: %u objects, %u obj files, loaded in %.1f ms\n", options.scene_file.c_str(),
+      (unsigned int)renderer->geometries.size(), scene_file->mesh_files_, load_time.count());
+    //Same shadows as the demo scenes
+    renderer->light_probe_samples_ = 2;
+  }
+  //Same vertical field of view as the window, at any aspect ratio
+  renderer->camera_.u = renderer->camera_.v * options.width / options.height;
+  renderer->light_samples_ = options.samples;
+  renderer->render_scale_ = options.scale;
+  renderer->deferred_shading_ = options.deferred;
+  //Frames of a still camera add up into one image
+  renderer->progressive_ = options.frames > 1;
+  renderer->worker_threads_ = options.threads;
+  renderer->pin_workers_ = options.pin;
+  renderer->Init(&screen);
+  //Every worker runs a tile job of each pass, the Mrays/s below are theirs
+  printf("%u x %u, %u frames, %u shadow samples, %u tile workers, %u threads pinned\n", options.width,
+    options.height, options.animate > 0 ? options.animate : options.frames, options.samples, renderer->workers(),
+    renderer->pinned_workers());
+
+  if (options.animate > 0 || options.stream) {
+    int result = options.stream ? RenderStream(renderer, stream, options) : RenderAnimation(renderer, options);
+    renderer->Clean();
+    delete renderer;
+    delete scene_file;
+    delete scene;
+    return result;
+  }
+
+  unsigned long long rays = 0;
+  auto start = std::chrono::high_resolution_clock::now();
+  for (unsigned int frame = 0; frame < options.frames; ++frame) {
+    renderer->Update();
+    rays += renderer->rays_traced();
+  }
+  std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+  double seconds = elapsed.count() / 1000.0;
+  printf("Rendered in %.1f ms, %.2f ms per frame\n", elapsed.count(), elapsed.count() / options.frames);
+  printf("%.2f Mrays, %.2f Mrays/s\n", rays / 1e6, seconds > 0.0 ? rays / 1e6 / seconds : 0.0);
+
+  bool written;
+  if (EndsWith(options.output, ".pfm")) {
+    std::vector<glm::vec3> colors;
+    unsigned int width, height;
+    renderer->GetLinearImage(&colors, &width, &height);
+    written = WritePFM(options.output.c_str(), colors, width, height);
+  } else if (EndsWith(options.output, ".png")) {
+    written = WritePNG(options.output.c_str(), screen);
+  } else {
+    written = WritePPM(options.output.c_str(), screen);
+  }
+  if (!written) {
+    printf("Can't write %s\n", options.output.c_str());
+  } else {
+    printf("Written %s\n", options.output.c_str());
+  }
+
+  renderer->Clean();
+  delete renderer;
+  delete scene_file;
+  delete scene;
+  return written ? 0 : 1;
+}
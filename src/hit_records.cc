@@ -0,0 +1,203 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#include "hit_records.h"
+#include "geometry.h"
+#include "renderer.h"
+
+#include <algorithm>
+#include <assert.h>
+
+static_assert(sizeof(HitRecord) == 32, "Two hit records per cache line");
+
+void HitRecords::Build(const std::vector<Geometry*>& geometries, HitRecord* storage, bool geometry_changed){
+  records_ = storage;
+  count_ = (unsigned int)geometries.size();
+  materials_.resize(count_);
+
+  //Same meshes at the same place keep their triangles
+  unsigned int mesh_count = 0;
+  bool meshes_moved = geometry_changed;
+  for (unsigned int i = 0; i < count_; ++i) {
+    const Geometry* geometry = geometries[i];
+    if (geometry->type() != kGeometryMesh) continue;
+    if (mesh_count >= mesh_sources_.size() || mesh_sources_[mesh_count] != geometry ||
+      mesh_positions_[mesh_count] != geometry->pos_) {
+      meshes_moved = true;
+    }
+    mesh_count++;
+  }
+  if (mesh_count != mesh_sources_.size()) meshes_moved = true;
+  if (meshes_moved) {
+    meshes_.clear();
+    triangles_.clear();
+    mesh_sources_.clear();
+    mesh_positions_.clear();
+    mesh_version_++;
+  }
+
+  unsigned int mesh = 0;
+  for (unsigned int i = 0; i < count_; ++i) {
+    Geometry* geometry = geometries[i];
+    HitRecord& record = records_[i];
+    record.a = glm::vec3(0.0f);
+    record.s = 0.0f;
+    record.b = glm::vec3(0.0f);
+    record.type = geometry->type();
+
+    switch (geometry->type()) {
+    case kGeometrySphere: {
+      Sphere* sphere = static_cast<Sphere*>(geometry);
+      record.a = sphere->pos_;
+      record.s = sphere->radius_ * sphere->radius_;
+      break;
+    }
+    case kGeometryPlane: {
+      Plane* plane = static_cast<Plane*>(geometry);
+      record.a = plane->normal_;
+      //Signed, so pos_ is a point of the plane on either side of the origin
+      record.s = -glm::dot(plane->pos_, plane->normal_);
+      break;
+    }
+    case kGeometryMesh: {
+      CustomGeometry* custom = static_cast<CustomGeometry*>(geometry);
+      record.a = custom->box_min();
+      record.b = custom->box_max();
+      record.mesh = mesh++;
+      if (!meshes_moved) break;
+
+      MeshRange range = { (unsigned int)triangles_.size(), (unsigned int)(custom->indices_.size() / 3) };
+      for (size_t t = 0; t + 2 < custom->indices_.size(); t += 3) {
+        HitTriangle triangle;
+        triangle.v0 = custom->vertices_[custom->indices_[t]].position + custom->pos_;
+        triangle.v1 = custom->vertices_[custom->indices_[t + 1]].position + custom->pos_;
+        triangle.v2 = custom->vertices_[custom->indices_[t + 2]].position + custom->pos_;
+        triangles_.push_back(triangle);
+      }
+      meshes_.push_back(range);
+      mesh_sources_.push_back(custom);
+      mesh_positions_.push_back(custom->pos_);
+      break;
+    }
+    default:
+      assert(!"Unknown geometry type");
+      break;
+    }
+
+    materials_[i].color = geometry->color_;
+    materials_[i].diffuse = geometry->diffuse_;
+    materials_[i].specular = geometry->specular_;
+  }
+}
+
+void HitRecords::Replicate(const HitRecords& from){
+  replica_records_.assign(from.records_, from.records_ + from.count_);
+  records_ = replica_records_.data();
+  count_ = from.count_;
+  materials_ = from.materials_;
+  if (mesh_version_ != from.mesh_version_) {
+    meshes_ = from.meshes_;
+    triangles_ = from.triangles_;
+    mesh_version_ = from.mesh_version_;
+  }
+}
+
+static bool BoxIntersection(const glm::vec3& box_min, const glm::vec3& box_max, const Ray& ray) {
+  float t1 = (box_min[0] - ray.origin[0]) / ray.dir[0];
+  float t2 = (box_max[0] - ray.origin[0]) / ray.dir[0];
+
+  float tmin = std::min(t1, t2);
+  float tmax = std::max(t1, t2);
+
+  for (int i = 1; i < 3; ++i) {
+    t1 = (box_min[i] - ray.origin[i]) / ray.dir[i];
+    t2 = (box_max[i] - ray.origin[i]) / ray.dir[i];
+
+    tmin = std::max(tmin, std::min(t1, t2));
+    tmax = std::min(tmax, std::max(t1, t2));
+  }
+
+  return tmax > std::max(tmin, 0.0f);
+}
+
+static inline float TriangleIntersection(const glm::vec3& ro, const glm::vec3& rd, const HitTriangle& triangle) {
+  glm::vec3 v1v0 = triangle.v1 - triangle.v0;
+  glm::vec3 v2v0 = triangle.v2 - triangle.v0;
+  glm::vec3 rov0 = ro - triangle.v0;
+  glm::vec3  n = cross(v1v0, v2v0);
+  glm::vec3  q = cross(rov0, rd);
+  float d = 1.0f / dot(rd, n);
+  float u = d * dot(-q, v2v0);
+  float v = d * dot(q, v1v0);
+  float t = d * dot(-n, rov0);
+  if (u < 0.0f || u>1.0f || v < 0.0f || (u + v)>1.0f) t = -1.0f;
+  return t;
+}
+
+float HitRecords::IntersectMesh(const HitRecord& record, const Ray& ray) const {
+  if (!BoxIntersection(record.a, record.b, ray)) return -1;
+
+  const MeshRange& range = meshes_[record.mesh];
+  const HitTriangle* triangle = triangles_.data() + range.first;
+  float result = 999999.0f;
+  for (unsigned int i = 0; i < range.count; ++i) {
+    float distance = TriangleIntersection(ray.origin, ray.dir, triangle[i]);
+    if (distance > -1 && distance < result) result = distance;
+  }
+
+  if (result >= 999997.0f) result = -1;
+  return result;
+}
+
+float HitRecords::Intersect(const Ray& ray, int* index) const {
+  float closest = 99999999.f;
+  int closest_index = -1;
+
+  for (unsigned int k = 0; k < count_; ++k) {
+    if ((int)k == ray.ignored_index_) continue;
+    const HitRecord& record = records_[k];
+
+    float result;
+    switch (record.type) {
+    case kGeometrySphere: {
+      glm::vec3 oc = ray.origin - record.a;
+      float a = glm::dot(ray.dir, ray.dir);
+      float b = 2.0 * glm::dot(oc, ray.dir);
+      float c = glm::dot(oc, oc) - record.s;
+      float discriminant = b * b - 4.0f * a * c;
+      if (discriminant < 0) continue;
+      result = (-b - sqrt(discriminant)) / (2.0f * a);
+      break;
+    }
+    case kGeometryPlane:
+      result = -(glm::dot(ray.origin, record.a) + record.s) / glm::dot(ray.dir, record.a);
+      break;
+    case kGeometryMesh:
+      result = IntersectMesh(record, ray);
+      break;
+    default:
+      //Build only writes the types above
+      assert(!"Unknown geometry type");
+      continue;
+    }
+    if (result == -1) continue;
+
+    if (result < closest && result > 0) {
+      closest = result;
+      closest_index = (int)k;
+    }
+  }
+
+  if (closest_index < 0 || closest >= 99999997.f) {
+    *index = -1;
+    return -1.0f;
+  }
+  *index = closest_index;
+  return closest;
+}
@@ -0,0 +1,140 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#include "image_io.h"
+#include "renderer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <array>
+
+bool WritePPM(const char* path, const TScreen& image){
+  FILE* file = fopen(path, "wb");
+  if (!file) return false;
+  fprintf(file, "P6\n%u %u\n255\n", image.width, image.height);
+
+  std::vector<unsigned char> line(image.width * 3);
+  for (unsigned int y = 0; y < image.height; ++y) {
+    const unsigned int* pixels = image.pixels + y * image.stride;
+    for (unsigned int x = 0; x < image.width; ++x) {
+      line[x * 3] = (pixels[x] >> 16) & 0xff;
+      line[x * 3 + 1] = (pixels[x] >> 8) & 0xff;
+      line[x * 3 + 2] = pixels[x] & 0xff;
+    }
+    fwrite(&line[0], 1, line.size(), file);
+  }
+  return fclose(file) == 0;
+}
+
+static unsigned int Crc32(unsigned int crc, const unsigned char* data, size_t size) {
+  //Built once, the initialization of a local static is thread safe
+  static const std::array<unsigned int, 256> table = [] {
+    std::array<unsigned int, 256> entries;
+    for (unsigned int i = 0; i < 256; ++i) {
+      unsigned int c = i;
+      for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      entries[i] = c;
+    }
+    return entries;
+  }();
+  crc = ~crc;
+  for (size_t i = 0; i < size; ++i) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+static void PutBigEndian(std::vector<unsigned char>& out, unsigned int value) {
+  out.push_back((unsigned char)(value >> 24));
+  out.push_back((unsigned char)(value >> 16));
+  out.push_back((unsigned char)(value >> 8));
+  out.push_back((unsigned char)value);
+}
+
+static void WriteChunk(FILE* file, const char* type, const std::vector<unsigned char>& data) {
+  std::vector<unsigned char> chunk;
+  PutBigEndian(chunk, (unsigned int)data.size());
+  chunk.insert(chunk.end(), type, type + 4);
+  chunk.insert(chunk.end(), data.begin(), data.end());
+  //The crc covers the type and the data
+  PutBigEndian(chunk, Crc32(0, &chunk[4], chunk.size() - 4));
+  fwrite(&chunk[0], 1, chunk.size(), file);
+}
+
+bool WritePNG(const char* path, const TScreen& image){
+  FILE* file = fopen(path, "wb");
+  if (!file) return false;
+  static const unsigned char kSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  fwrite(kSignature, 1, sizeof(kSignature), file);
+
+  std::vector<unsigned char> header;
+  PutBigEndian(header, image.width);
+  PutBigEndian(header, image.height);
+  header.push_back(8); //Bits per channel
+  header.push_back(2); //RGB
+  header.push_back(0);
+  header.push_back(0);
+  header.push_back(0);
+  WriteChunk(file, "IHDR", header);
+
+  //Every row starts with its filter, none
+  std::vector<unsigned char> raw;
+  raw.reserve((size_t)(image.width * 3 + 1) * image.height);
+  for (unsigned int y = 0; y < image.height; ++y) {
+    const unsigned int* pixels = image.pixels + y * image.stride;
+    raw.push_back(0);
+    for (unsigned int x = 0; x < image.width; ++x) {
+      raw.push_back((pixels[x] >> 16) & 0xff);
+      raw.push_back((pixels[x] >> 8) & 0xff);
+      raw.push_back(pixels[x] & 0xff);
+    }
+  }
+
+  //zlib stream of stored blocks of up to 65535 bytes
+  std::vector<unsigned char> data;
+  data.push_back(0x78);
+  data.push_back(0x01);
+  size_t offset = 0;
+  do {
+    size_t size = raw.size() - offset;
+    if (size > 65535) size = 65535;
+    data.push_back(offset + size == raw.size() ? 1 : 0);
+    data.push_back((unsigned char)size);
+    data.push_back((unsigned char)(size >> 8));
+    data.push_back((unsigned char)~size);
+    data.push_back((unsigned char)(~size >> 8));
+    data.insert(data.end(), raw.begin() + offset, raw.begin() + offset + size);
+    offset += size;
+  } while (offset < raw.size());
+  unsigned int a = 1, b = 0;
+  for (size_t i = 0; i < raw.size(); ++i) {
+    a = (a + raw[i]) % 65521;
+    b = (b + a) % 65521;
+  }
+  PutBigEndian(data, (b << 16) | a);
+  WriteChunk(file, "IDAT", data);
+  WriteChunk(file, "IEND", std::vector<unsigned char>());
+  return fclose(file) == 0;
+}
+
+bool WritePFM(const char* path, const std::vector<glm::vec3>& colors,
+  unsigned int width, unsigned int height){
+  FILE* file = fopen(path, "wb");
+  if (!file) return false;
+  //Negative scale is little endian, rows go bottom to top
+  fprintf(file, "PF\n%u %u\n-1.0\n", width, height);
+  for (unsigned int y = height; y-- > 0;) {
+    fwrite(&colors[(size_t)y * width], sizeof(glm::vec3), width, file);
+  }
+  return fclose(file) == 0;
+}
+
+bool WriteImage(const char* path, const TScreen& image){
+  size_t length = strlen(path);
+  if (length >= 4 && !strcmp(path + length - 4, ".png")) return WritePNG(path, image);
+  return WritePPM(path, image);
+}
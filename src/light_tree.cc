@@ -0,0 +1,109 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#include "light_tree.h"
+#include "renderer.h"
+
+#include <algorithm>
+
+void LightTree::Build(const std::vector<Light>& lights){
+  nodes_.clear();
+  order_.resize(lights.size());
+  if (lights.empty()) return;
+
+  for (int i = 0; i < (int)lights.size(); ++i) order_[i] = i;
+  nodes_.reserve(lights.size() * 2);
+  BuildNode(lights, 0, (int)lights.size());
+}
+
+int LightTree::BuildNode(const std::vector<Light>& lights, int first, int last){
+  int index = (int)nodes_.size();
+  nodes_.push_back(LightTreeNode());
+
+  LightTreeNode node;
+  node.bbox_min = lights[order_[first]].pos;
+  node.bbox_max = lights[order_[first]].pos;
+  node.intensity = 0.0f;
+  node.left = -1;
+  node.right = -1;
+  node.light_index = order_[first];
+
+  for (int i = first; i < last; ++i) {
+    const Light& light = lights[order_[i]];
+    node.bbox_min = glm::min(node.bbox_min, light.pos);
+    node.bbox_max = glm::max(node.bbox_max, light.pos);
+    node.intensity += light.intensity * (light.color.r + light.color.g + light.color.b);
+  }
+
+  if (last - first > 1) {
+    //Median split on the longest axis
+    glm::vec3 extent = node.bbox_max - node.bbox_min;
+    int axis = 0;
+    if (extent.y > extent.x) axis = 1;
+    if (extent.z > extent[axis]) axis = 2;
+
+    int middle = (first + last) / 2;
+    std::nth_element(order_.begin() + first, order_.begin() + middle, order_.begin() + last,
+      [&lights, axis](int a, int b) { return lights[a].pos[axis] < lights[b].pos[axis]; });
+
+    node.left = BuildNode(lights, first, middle);
+    node.right = BuildNode(lights, middle, last);
+  }
+
+  nodes_[index] = node;
+  return index;
+}
+
+float LightTree::Importance(const LightTreeNode& node, const glm::vec3& pos, const glm::vec3& normal) const{
+  //Reject clusters fully behind the surface
+  bool facing = false;
+  for (int i = 0; i < 8 && !facing; ++i) {
+    glm::vec3 corner((i & 1) ? node.bbox_max.x : node.bbox_min.x,
+      (i & 2) ? node.bbox_max.y : node.bbox_min.y,
+      (i & 4) ? node.bbox_max.z : node.bbox_min.z);
+    facing = glm::dot(corner - pos, normal) > 0.0f;
+  }
+  if (!facing) return 0.0f;
+
+  //Distance to the cluster clamped by its size, so points inside a big
+  //cluster don't blow up the estimation
+  glm::vec3 center = (node.bbox_min + node.bbox_max) * 0.5f;
+  glm::vec3 half_extent = (node.bbox_max - node.bbox_min) * 0.5f;
+  glm::vec3 to_center = center - pos;
+  float dist2 = glm::max(glm::dot(to_center, to_center), glm::dot(half_extent, half_extent));
+
+  return node.intensity / glm::max(dist2, 0.0001f);
+}
+
+int LightTree::Sample(const glm::vec3& pos, const glm::vec3& normal, float u, float& pdf) const{
+  pdf = 1.0f;
+  if (nodes_.empty()) return -1;
+
+  const LightTreeNode* node = &nodes_[0];
+  while (node->left != -1) {
+    float left = Importance(nodes_[node->left], pos, normal);
+    float right = Importance(nodes_[node->right], pos, normal);
+    if (left + right <= 0.0f) return -1;
+
+    //Pick a child and reuse the random number for the next level
+    float p_left = left / (left + right);
+    if (u < p_left) {
+      u = u / p_left;
+      pdf *= p_left;
+      node = &nodes_[node->left];
+    } else {
+      u = (u - p_left) / (1.0f - p_left);
+      pdf *= 1.0f - p_left;
+      node = &nodes_[node->right];
+    }
+    u = glm::min(u, 0.99999994f);
+  }
+
+  return node->light_index;
+}
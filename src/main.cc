@@ -9,175 +9,44 @@ This program is a college project uploaded for showcase purposes.
 
 
 #include <stdio.h>
+#include <string.h>
 
 #include <SDL.h>
 #include "SDL_timer.h"
 #include "renderer.h"
-#include "geometry.h"
+#include "scene.h"
+#include "scene_file.h"
 
 #define PX_SCHED_IMPLEMENTATION
 #include "px_sched.h"
 
+#ifdef _WIN32
 #include <Windows.h>
-
-float g_scale_ = 0.5f;
+#endif
 
 struct sState {
   Renderer renderer_;
-  Sphere sphere1_;
-  Sphere sphere2_;
-  Sphere sphere3_;
-  Sphere sphere4_;
-  Plane floor_;
-  CustomGeometry cube_;
-  CustomGeometry cube2_;
-  CustomGeometry teapot_;
-  Light light1_;
+  DemoScene scene_;
+  SceneFile scene_file_;
+  const char* scene_path_ = nullptr; //Given in the command line
   float z_angle_;
 
   bool config_mode = true;
   bool light_rotation = true;
 } state;
 
-void Prepare() {
-  state.renderer_.camera_.pos = {0.0f,0.0f,0.0f};
-  state.renderer_.camera_.focal_length = 1.0f;
-  state.renderer_.camera_.u = 1.77f;
-  state.renderer_.camera_.v = 1.0f;
-
-  state.renderer_.light_offset_ = 0.01f;
-  state.renderer_.light_samples_ = 2;
-
- state.sphere1_.pos_ = glm::vec3(0.0f, 0.0f, -20.0f);
- state.sphere1_.color_ = glm::vec3(1.0f,0.32f,0.36f);
- state.sphere1_.radius_ = 4.0f;
- state.sphere1_.diffuse_ = 0.0f;
- state.sphere1_.specular_ = 1.0f;
- state.sphere1_.InitAABB();
-
- state.sphere2_.pos_ = glm::vec3(5.0f, -1.0f, -15.0f);
- state.sphere2_.color_ = glm::vec3(0.9f, 0.76f, 0.46f);
- state.sphere2_.radius_ = 2.0f;
- state.sphere2_.diffuse_ = 0.0f;
- state.sphere2_.specular_ = 1.0f;
- state.sphere2_.InitAABB();
-
- state.sphere3_.pos_ = glm::vec3(5.0f, 0.0f, -25.0f);
- state.sphere3_.color_ = glm::vec3(0.65f, 0.77f, 0.97f);
- state.sphere3_.radius_ = 3.0f;
- state.sphere3_.diffuse_ = 0.0f;
- state.sphere3_.specular_ = 1.0f;
- state.sphere3_.InitAABB();
-
- state.sphere4_.pos_ = glm::vec3(-5.5f,0.0f,-15.0f);
- state.sphere4_.color_ = glm::vec3(0.90f, 0.90f, 0.90f);
- state.sphere4_.radius_ = 3.0f;
- state.sphere4_.diffuse_ = 1.0f;
- state.sphere4_.specular_ = 0.0f;
- state.sphere4_.InitAABB();
-
- state.floor_.pos_ = glm::vec3(0.0f, -10.0f, 0.0f);
- state.floor_.color_ = glm::vec3(1.0f, 0.0f, 0.0f);
- state.floor_.diffuse_ = 1.0f;
- state.floor_.specular_ = 1.0f;
-
- state.cube_.pos_ = { 3.0f,0.0f,-5.0f };
- state.cube_.color_ = { 1.0f,1.0f,0.0f };
- state.cube_.diffuse_ = 0.0f;
- state.cube_.specular_ = 1.0f;
- state.cube_.use_fast_normal_ = false;
- state.cube_.LoadObj("../../data/cube.obj");
-
- state.cube2_.pos_ = { -5.0f,0.0f,-10.0f };
- state.cube2_.color_ = { 0.0f,1.0f,0.0f };
- state.cube2_.diffuse_ = 1.0f;
- state.cube2_.specular_ = 1.0f;
- state.cube2_.use_fast_normal_ = false;
- state.cube2_.LoadObj("../../data/cube.obj");
-
- state.teapot_.pos_ = { 2.0f,1.0f,-20.0f };
- state.teapot_.color_ = { 0.6f,0.2f,0.4f };
- state.teapot_.diffuse_ = 1.0f;
- state.teapot_.specular_ = 0.0f;
- state.teapot_.use_fast_normal_ = false;
- state.teapot_.LoadObj("../../data/teapot.obj");
-
- state.renderer_.geometries.push_back(&state.sphere1_);
- state.renderer_.geometries.push_back(&state.sphere2_);
- state.renderer_.geometries.push_back(&state.sphere3_);
- state.renderer_.geometries.push_back(&state.sphere4_);
- state.renderer_.geometries.push_back(&state.floor_);
-
- state.light1_.pos = glm::vec3(1.0f, -1.0f, -4.0f);
- state.light1_.intensity = 1.0f;
- state.light1_.color = { 0.5f,0.0f,0.0f };
-
- state.renderer_.lights_.push_back(state.light1_);
- state.z_angle_ = 0.0f;
+void LoadScene() {
+  //In flight frames still read the old objects. A file that doesn't load
+  //leaves the current scene as it was, the demo one at startup.
+  state.renderer_.WaitIdle();
+  LoadSceneFile(state.scene_path_, &state.scene_file_, &state.renderer_);
 }
 
-static inline unsigned int BlendARGB(unsigned int pix0, unsigned int pix1, int alphafx8)
-{
-  // Version rapida. Trabajamos en pares de componentes, operando varios
-  // bitfields a la vez
-  unsigned int ag0 = (pix0 & 0xff00ff00) >> 8;
-  unsigned int rb0 = pix0 & 0x00ff00ff;
-  unsigned int ag1 = (pix1 & 0xff00ff00) >> 8;
-  unsigned int rb1 = pix1 & 0x00ff00ff;
-
-  unsigned int ag = ((ag0 * alphafx8 + ag1 * (0x100 - alphafx8)) >> 8) & 0xff00ff;
-  unsigned int rb = ((rb0 * alphafx8 + rb1 * (0x100 - alphafx8)) >> 8) & 0xff00ff;
-
-  return ((ag << 8) | rb);
-}
-
-static inline unsigned int BilinearSampling(unsigned int pix_h0v0,
-  unsigned int pix_h1v0,
-  unsigned int pix_h0v1,
-  unsigned int pix_h1v1,
-  int alpha_hor_fx8,
-  int alpha_ver_fx8)
-{
-  // La funcion muestrado (sampling) bilinear
-  // Devuelve una muestra ponderada entre los 4 texels vecinos a la coordenada dada
-  // Blend de los pixels en vertical
-  unsigned int s0 = BlendARGB(pix_h0v0, pix_h0v1, alpha_ver_fx8);
-  unsigned int s1 = BlendARGB(pix_h1v0, pix_h1v1, alpha_ver_fx8);
-  // Blend horizontal de los dos anteriores
-  unsigned int s = BlendARGB(s0, s1, alpha_hor_fx8);
-  return s;
-}
-
-void Scale(SDL_Surface *src, SDL_Surface *dst) {
-  
-  float stepy = 0;
-
-  for (int y = 0; y < dst->h; ++y) {
-    unsigned int* dst_line = (unsigned int*)dst->pixels + (y * (dst->pitch >> 2));
-  
-    unsigned int* src_line0 = (unsigned int*)src->pixels + (int)stepy * (src->pitch >> 2);
-    unsigned int* src_line1 = (unsigned int*)src->pixels + ((int)stepy+1) * (src->pitch >> 2);
-
-    float stepx = 0;
-
-    unsigned int factor = (unsigned int)(g_scale_ * 256.0f);
-
-    for (int x = 0; x < dst->w; ++x) {
-      dst_line[x] = BilinearSampling(
-        src_line0[(int)stepx],
-        src_line0[(int)(stepx + 1) % src->w],
-        src_line1[(int)stepx],
-        src_line1[(int)(stepx + 1) % src->w],
-        factor,
-        factor);
-
-      stepx += g_scale_;
-    }
-  
-    stepy += g_scale_;
-  }
-
-
+void Prepare() {
+  PrepareDemoScene(&state.scene_, &state.renderer_, "../../data");
+  if (state.scene_path_) LoadScene();
+  state.renderer_.render_scale_ = 0.5f;
+  state.z_angle_ = 0.0f;
 }
 
 void Config(unsigned int time) {
@@ -195,27 +64,65 @@ void Config(unsigned int time) {
     - Camera down: S
 
     - Enable/Disable light rotation: Q
-    - Cycle Threads used (number of total tasks launched): T
+    - Cycle soft shadow samples: L
+    - Cycle sampler (random, sobol, blue noise): P
+    - Enable/Disable deferred shading (G-buffer pass): G
+    - Enable/Disable progressive accumulation on still frames: R
+    - Enable/Disable temporal reprojection when the camera moves: M
+    - Enable/Disable checkerboard rendering: K
 
     - Load Base scene: B
     - Load Heavy Scene With Objs: N
+    - Reload the scene file given in the command line: I
     
     - Enable Upscaling render optimisation: U
+    - Enable/Disable edge adaptive upscale: E
+    - Enable/Disable dynamic resolution (30 fps target): F
+    - Cycle frame latency (0, 1, 2 frames queued): V
+    - Cycle tone curve (clamp, reinhard, filmic): O
+    - Enable/Disable output dither: J
 
   )STR";
   if (state.config_mode) {
     system("cls");
     printf(string);
-    printf("Current max number of processing tasks: %d\n", state.renderer_.num_threads_);
+    //Frames render on the workers while this runs, only the stats of the
+    //presented one are safe to read
+    const FrameStats& stats = state.renderer_.frame_stats();
+    printf("Tile workers: %u\n", state.renderer_.workers());
+    printf("Tile size: %d, %d work items (cost balancing %s)\n", state.renderer_.tile_size_,
+      (int)stats.work_items, state.renderer_.cost_balancing_ ? "on" : "off");
+    printf("Current soft shadow samples: %d (%d probes)\n", state.renderer_.light_samples_,
+      state.renderer_.light_probe_samples_);
+    printf("Current sampler: %d\n", state.renderer_.sampler_type_);
+    printf("Deferred shading: %s\n", state.renderer_.deferred_shading_ ? "on" : "off");
+    printf("Primary and reflection hits reused: %s\n", stats.hits_reused ? "yes" : "no");
+    printf("Accumulated frames: %d\n", stats.accumulated_frames);
+    printf("Reprojected pixels: %d\n", stats.reused_pixels);
+    printf("Checkerboard: %s\n", state.renderer_.checkerboard_ ? "on" : "off");
+    printf("Render scale: %.2f (target frame time %.1f ms)\n", state.renderer_.render_scale_,
+      state.renderer_.target_frame_time());
+    printf("Frame latency: %d\n", state.renderer_.frame_latency_);
+    printf("Edge adaptive upscale: %s (%d pixels traced)\n", state.renderer_.edge_adaptive_upscale_ ? "on" : "off",
+      stats.edge_pixels);
+    printf("Tone curve: %d (sRGB %s, dither %s)\n", state.renderer_.tone_curve_,
+      state.renderer_.srgb_output_ ? "on" : "off", state.renderer_.dither_ ? "on" : "off");
+    printf("Frame memory: %u KB in %u allocations, %u from malloc\n",
+      (unsigned int)(stats.arena_bytes / 1024), stats.arena_allocations, stats.arena_fallbacks);
   }
   
   printf("Delta time: %d ms \n", SDL_GetTicks() - time);
 }
 
+//RayTracer [--pin] [file.scene]
 int main(int argc, char** argv) {
+  for (int i = 1; i < argc; ++i) {
+    //Pinning happens in Init, it can't be toggled later
+    if (!strcmp(argv[i], "--pin")) state.renderer_.pin_workers_ = true;
+    else state.scene_path_ = argv[i];
+  }
 
   SDL_Surface* g_SDLSrf;
-  SDL_Surface* g_LowScale;
   int req_w = 1280;
   int req_h = 720;
 
@@ -249,46 +156,37 @@ int main(int argc, char** argv) {
     0x000000FF,
     0xFF000000);
 
-  g_LowScale = SDL_CreateRGBSurface(0, req_w * g_scale_, req_h * g_scale_, 32,
-    0x00FF0000,
-    0x0000FF00,
-    0x000000FF,
-    0xFF000000);
-
   SDL_Texture* sdlTexture = SDL_CreateTexture(renderer,
     SDL_PIXELFORMAT_ARGB8888,
     SDL_TEXTUREACCESS_STREAMING,
     req_w, req_h);
 
   TScreen screen;
-  screen.pixels = (unsigned int*)g_LowScale->pixels;
-  screen.width = g_LowScale->w;
-  screen.height = g_LowScale->h;
-  screen.stride = g_LowScale->pitch >> 2; // >> 2 if pixels are int
+  screen.pixels = (unsigned int*)g_SDLSrf->pixels;
+  screen.width = g_SDLSrf->w;
+  screen.height = g_SDLSrf->h;
+  screen.stride = g_SDLSrf->pitch >> 2; // >> 2 if pixels are int
 
   Prepare();
   state.renderer_.Init(&screen);
+  PrintTopology(state.renderer_.topology());
+  printf("%d scheduler threads pinned%s\n", state.renderer_.pinned_workers(),
+    state.renderer_.pin_workers_ ? "" : ", start with --pin to pin them");
 
   unsigned int time = SDL_GetTicks();
   while (!end) {
     SDL_Event event;
 
-    SDL_LockSurface(g_SDLSrf);
-    SDL_LockSurface(g_LowScale);
-    state.renderer_.Update();
+    //Queues the next frame, an earlier one is presented while it renders
+    state.renderer_.BeginFrame();
+    const TScreen* frame = state.renderer_.EndFrame();
+    if (frame) {
+      SDL_UpdateTexture(sdlTexture, NULL, frame->pixels, frame->stride * sizeof(unsigned int));
+      SDL_RenderClear(renderer);
+      SDL_RenderCopy(renderer, sdlTexture, NULL, NULL);
 
-    if (g_scale_ <= 0.5f) {
-      Scale(g_LowScale, g_SDLSrf);
+      SDL_RenderPresent(renderer);
     }
-
-    SDL_UnlockSurface(g_LowScale);
-    SDL_UnlockSurface(g_SDLSrf);
-
-    SDL_UpdateTexture(sdlTexture, NULL, g_SDLSrf->pixels, g_SDLSrf->pitch);
-    SDL_RenderClear(renderer);
-    SDL_RenderCopy(renderer, sdlTexture, NULL, NULL);
-
-    SDL_RenderPresent(renderer);
   
 
 
@@ -307,38 +205,51 @@ int main(int argc, char** argv) {
           state.renderer_.camera_.pos.x += 0.3f;
         if (event.key.keysym.sym == SDLK_q)
           state.light_rotation = !state.light_rotation;
-        if (event.key.keysym.sym == SDLK_t) {
-          state.renderer_.num_threads_ = (state.renderer_.num_threads_ + 10);
-          if (state.renderer_.num_threads_ >= 100) state.renderer_.num_threads_ = 1;
-        }
-        if (event.key.keysym.sym == SDLK_b) {
-          state.renderer_.geometries.clear();
-          state.renderer_.geometries.push_back(&state.sphere1_);
-          state.renderer_.geometries.push_back(&state.sphere2_);
-          state.renderer_.geometries.push_back(&state.sphere3_);
-          state.renderer_.geometries.push_back(&state.sphere4_);
-          state.renderer_.geometries.push_back(&state.floor_);
+        if (event.key.keysym.sym == SDLK_l) {
+          state.renderer_.light_samples_ *= 2;
+          if (state.renderer_.light_samples_ > 32) state.renderer_.light_samples_ = 2;
         }
-        if (event.key.keysym.sym == SDLK_n) {
-          state.renderer_.geometries.clear();
-          state.renderer_.geometries.push_back(&state.cube_);
-          state.renderer_.geometries.push_back(&state.cube2_);
-          state.renderer_.geometries.push_back(&state.teapot_);
-          state.renderer_.geometries.push_back(&state.floor_);
+        if (event.key.keysym.sym == SDLK_p) {
+          state.renderer_.sampler_type_ = (SamplerType)((state.renderer_.sampler_type_ + 1) % kSamplerCount);
         }
+        if (event.key.keysym.sym == SDLK_g)
+          state.renderer_.deferred_shading_ = !state.renderer_.deferred_shading_;
+        if (event.key.keysym.sym == SDLK_r)
+          state.renderer_.progressive_ = !state.renderer_.progressive_;
+        if (event.key.keysym.sym == SDLK_m)
+          state.renderer_.temporal_reprojection_ = !state.renderer_.temporal_reprojection_;
+        if (event.key.keysym.sym == SDLK_k)
+          state.renderer_.checkerboard_ = !state.renderer_.checkerboard_;
+        if (event.key.keysym.sym == SDLK_b)
+          UseDemoScene(&state.scene_, &state.renderer_, kSceneBase);
+        if (event.key.keysym.sym == SDLK_n)
+          UseDemoScene(&state.scene_, &state.renderer_, kSceneObjs);
+        if (event.key.keysym.sym == SDLK_i && state.scene_path_)
+          LoadScene();
         if (event.key.keysym.sym == SDLK_u) {
-          if (g_scale_ == 0.5f) {
-            screen.pixels = (unsigned int*)g_SDLSrf->pixels;
-            screen.width = g_SDLSrf->w;
-            screen.height = g_SDLSrf->h;
-            screen.stride = g_SDLSrf->pitch >> 2; // >> 2 if pixels are int
-            g_scale_ = 1.0f;
+          state.renderer_.SetTargetFrameTime(0.0f);
+          if (state.renderer_.render_scale_ < 1.0f) {
+            state.renderer_.render_scale_ = 1.0f;
+          } else {
+            state.renderer_.render_scale_ = 0.5f;
+          }
+        }
+        if (event.key.keysym.sym == SDLK_e)
+          state.renderer_.edge_adaptive_upscale_ = !state.renderer_.edge_adaptive_upscale_;
+        if (event.key.keysym.sym == SDLK_v)
+          state.renderer_.frame_latency_ = (state.renderer_.frame_latency_ + 1) % 3;
+        if (event.key.keysym.sym == SDLK_o) {
+          //The curves other than the clamp expect linear colors
+          state.renderer_.tone_curve_ = (ToneCurve)((state.renderer_.tone_curve_ + 1) % kToneCurveCount);
+          state.renderer_.srgb_output_ = state.renderer_.tone_curve_ != kToneClamp;
+        }
+        if (event.key.keysym.sym == SDLK_j)
+          state.renderer_.dither_ = !state.renderer_.dither_;
+        if (event.key.keysym.sym == SDLK_f) {
+          if (state.renderer_.target_frame_time() > 0.0f) {
+            state.renderer_.SetTargetFrameTime(0.0f);
           } else {
-            screen.pixels = (unsigned int*)g_LowScale->pixels;
-            screen.width = g_LowScale->w;
-            screen.height = g_LowScale->h;
-            screen.stride = g_LowScale->pitch >> 2; // >> 2 if pixels are int
-            g_scale_ = 0.5f;
+            state.renderer_.SetTargetFrameTime(33.3f);
           }
         }
         break;
@@ -9,26 +9,26 @@ This program is a college project uploaded for showcase purposes.
 
 #include "renderer.h"
 #include "geometry.h"
-#include "glm\gtx\transform.hpp"
+#include "glm/gtx/transform.hpp"
 
 #include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#if defined(_M_X64) || defined(_M_IX86_FP) || defined(__SSE2__)
+#define RENDERER_SSE2 1
+#include <emmintrin.h>
+#endif
 
 //For cpu tracing
 #include "minitrace.h"
 
-static inline unsigned int ConvertToRGBA(glm::vec3 color) {
-  unsigned int out_color_ = 0;
-
-  for (int i = 0; i < 3; i++) {
-    if (color[i] > 1.0f) color[i] = 1.0f;
-  }
-
-  out_color_ |= ((int)(color.r * 255.0f) << 16);
-  out_color_ |= ((int)(color.g * 255.0f) << 8);
-  out_color_ |= ((int)(color.b * 255.0f));
-
-  return out_color_;
-}
+//Rays cast by this thread since its last job ended, the jobs add them to
+//the frame's count
+static thread_local unsigned int t_rays_traced = 0;
+//Hit records the running job reads, nullptr for hit_records_
+static thread_local const HitRecords* t_hit_records = nullptr;
 
 static glm::vec3 BackgroundColor(const Ray& ray) {
 
@@ -42,8 +42,68 @@ static inline glm::vec3 Reflect(const glm::vec3& v, const glm::vec3& n) {
 }
 
 Renderer::Renderer(){
-  num_threads_ = 64;
   num_bounces_ = 4;
+  sampler_type_ = kSamplerSobol;
+  many_lights_threshold_ = 8;
+  many_lights_samples_ = 4;
+  deferred_shading_ = true;
+  progressive_ = true;
+  temporal_reprojection_ = true;
+  checkerboard_ = false;
+  edge_adaptive_upscale_ = true;
+  edge_luminance_threshold_ = 0.08f;
+  edge_depth_tolerance_ = 0.05f;
+  edge_pixels_ = 0;
+  tile_size_ = 16;
+  cost_balancing_ = true;
+  tiles_width_ = 0;
+  tiles_height_ = 0;
+  tiles_size_ = 0;
+  render_scale_ = 1.0f;
+  min_render_scale_ = 0.25f;
+  target_frame_ms_ = 0.0f;
+  last_target_frame_ms_ = 0.0f;
+  adapted_render_scale_ = 1.0f;
+  frame_latency_ = 1;
+  worker_threads_ = 0;
+  pin_workers_ = false;
+  workers_ = 0;
+  frame_stats_ = FrameStats();
+  pinned_workers_ = 0;
+  first_touch_ = 0;
+  replicate_records_ = false;
+  node_queues_ = 1;
+  tone_curve_ = kToneClamp;
+  exposure_ = 1.0f;
+  srgb_output_ = false;
+  dither_ = false;
+  tonemap_tiles_ = false;
+  feed_bands_ = false;
+  bands_ = 0;
+  mask_ready_ = nullptr;
+  upscale_ready_ = nullptr;
+  band_rows_ = nullptr;
+  submitted_jobs_ = 0;
+  submit_ms_ = 0.0f;
+  arena_bytes_ = 0;
+  arena_allocations_ = 0;
+  arena_fallbacks_ = 0;
+  rays_traced_ = 0;
+  frame_rays_ = 0;
+  frames_submitted_ = 0;
+  frames_presented_ = 0;
+  output_ = nullptr;
+  frame_geometry_dirty_ = false;
+  frame_ms_average_ = 0.0f;
+  frames_under_budget_ = 0;
+  render_target_.width = 0;
+  render_target_.height = 0;
+  render_target_.stride = 0;
+  render_target_.pixels = nullptr;
+  reprojection_depth_tolerance_ = 0.05f;
+  light_samples_ = 2;
+  light_probe_samples_ = 0;
+  light_offset_ = 0.01f;
 
 
   glm::mat4 X = glm::rotate(-1.5f, glm::vec3(1.0f, 0.0f, 0.0f));
@@ -69,107 +129,317 @@ Renderer::~Renderer(){
 
 void Renderer::Init(TScreen *screen){
   screen_ = screen;
+  target_ = screen;
+
+
+  //Worker count and pinning are set before Init
+  topology_ = DetectTopology();
+  unsigned int workers = worker_threads_ > 0 ? worker_threads_ : topology_.logical_processors;
+  workers_ = workers;
+  px_sched::SchedulerParams params;
+  params.max_running_threads = (uint16_t)workers;
+  //The spare thread takes over while a frame job waits for its passes
+  params.num_threads = (uint16_t)(workers + 1);
+  //Small tiles make many upscale bands, each one two jobs
+  params.max_number_tasks = kMaxSchedulerTasks;
+  params.mem_callbacks.alloc_fn = &FrameArena::SchedulerAlloc;
+  params.mem_callbacks.free_fn = &FrameArena::SchedulerFree;
+  //A region for each worker, the spare one and the thread calling Update
+  arena_.Init(workers + 2, kArenaRegionBytes);
+  schd.init(params);
+  pinned_workers_ = pin_workers_ ? PinWorkers(workers + 1) : 0;
+  frame_index_ = 0;
+  //Everything counts as changed on the first frame
+  frame_changes_ = kChangeCamera | kChangeGeometry | kChangeLight | kChangeScreen;
+  last_camera_ = Camera();
+  last_num_bounces_ = 0;
+  last_width_ = 0;
+  last_height_ = 0;
+  last_directional_dir_ = glm::vec3(0.0f, 0.0f, 0.0f);
+  last_directional_intensity_ = 0.0f;
+  last_light_samples_ = 0;
+  last_light_offset_ = 0.0f;
+  geometry_dirty_ = true;
+  gbuffer_valid_ = false;
+  hits_reused_ = false;
+  accumulated_frames_ = 0;
+  use_pixel_plan_ = false;
+  reused_pixels_ = 0;
+  gbuffer_complete_ = false;
+  //For tracing
+  mtr_init("../../../trace.json");
+}
 
-  horizontal = glm::vec3(camera_.u, 0, 0);
-  vertical = -glm::vec3(0.0f, camera_.v, 0.0f);
+unsigned int Renderer::PinWorkers(unsigned int threads){
+  //Processors grouped by node, so the first workers fill the first node
+  std::vector<unsigned int> processors;
+  for (unsigned int node = 0; node < topology_.numa_nodes; ++node) {
+    for (unsigned int i = 0; i < topology_.logical_processors; ++i) {
+      if (topology_.processor_node[i] == node) processors.push_back(i);
+    }
+  }
 
-  schd.init();
-  srand(time(NULL));
+  //px_sched has no hook in its threads, so every thread gets a job that
+  //pins it and waits for the others to start, no thread can run two of
+  //them. The spare thread included: the waiting jobs tell the scheduler
+  //they sleep, so it wakes more threads than max_running_threads. Gives
+  //up after a while if some thread never picks one up.
+  PinState state;
+  state.renderer = this;
+  state.processors = &processors;
+  state.threads = threads;
+  state.started = 0;
+  state.pinned = 0;
+  px_sched::Job job = { &Renderer::PinJob, &state };
+  for (unsigned int i = 0; i < threads; ++i) {
+    schd.run(job, &sync_obj);
+  }
+  schd.waitFor(sync_obj);
+  return state.pinned;
+}
 
-  directional_dir_samples_.resize(light_samples_);
-  //For tracing
-  mtr_init("../../../trace.json");
+void Renderer::PinJob(void* arg){
+  PinState& state = *(PinState*)arg;
+  const std::vector<unsigned int>& processors = *state.processors;
+  unsigned int processor = processors[state.started.fetch_add(1) % processors.size()];
+  if (PinCurrentThread(processor, state.renderer->topology_.processor_node[processor])) state.pinned++;
+  auto start = std::chrono::high_resolution_clock::now();
+  px_sched::Scheduler::CurrentThreadSleeps();
+  while (state.started.load() < state.threads &&
+    std::chrono::high_resolution_clock::now() - start < std::chrono::milliseconds(100)) {
+    std::this_thread::yield();
+  }
+  px_sched::Scheduler::CurrentThreadWakesUp();
 }
 
 void Renderer::Clean(){
+  WaitIdle();
   geometries.clear();
   mtr_shutdown();
 }
 
-glm::vec3 Renderer::ComputeLighting(RayInfo info){
+glm::vec3 Renderer::ComputeLightSample(const RayInfo& info, const glm::vec3& light_dir, bool& lit, Sampler& sampler){
+  Ray ray;
+  ray.origin = info.pos;
+  ray.dir = -light_dir;
+  ray.ignored_index_ = info.geometry_index_;
+  //Diffuse
+  RayInfo result = ComputeRay(ray, 0, sampler);
+
+  float diffuse_strength = 0.0f;
+  float specular_strength = 0.0f;
+  lit = result.dist == -1;
+  if (lit) { //if collision then shadow
+    diffuse_strength = glm::max(glm::dot(info.normal, -light_dir), 0.0f) * frame_.directional_inrtensity_;
+
+    glm::vec3 viewDir = glm::normalize(frame_.camera_.pos - info.pos);
+    glm::vec3 reflectDir = glm::reflect(light_dir, info.normal);
+    specular_strength = glm::pow(glm::max(glm::dot(viewDir, reflectDir), 0.0f), 64) * frame_.directional_inrtensity_;
+
+  }
+
+  const Material& material = records().material(info.geometry_index_);
+  return info.color * 0.2f + diffuse_strength * material.diffuse
+    + specular_strength * material.specular;
+}
+
+glm::vec3 Renderer::ComputeLighting(RayInfo info, Sampler& sampler){
+  return ComputeLighting(info, sampler, nullptr, 0);
+}
+
+glm::vec3 Renderer::ComputeLighting(RayInfo info, Sampler& sampler, const PointLightRun* run, unsigned int pixel){
   glm::vec3 total_light_ = { 0.0f,0.0f,0.0f };
   
   //Directional
+  //Soft shadow directions are points of the sampler on a disk of radius
+  //light_offset_ around the light. The first probes of a block are already
+  //spread over the disk, if they all agree the point is fully lit or fully
+  //shadowed and the rest are skipped, otherwise it is in a penumbra
+  unsigned int probes = frame_.light_samples_;
+  if (frame_.light_probe_samples_ > 0 && frame_.light_probe_samples_ < frame_.light_samples_)
+    probes = frame_.light_probe_samples_;
+
+  unsigned int dimension = sampler.NextDimension();
+  unsigned int first_index = sampler.sample_index() * frame_.light_samples_;
+
+  unsigned int lit_count = 0;
+  for (unsigned int i = 0; i < probes; ++i) {
+    bool lit;
+    total_light_ += ComputeLightSample(info, SampleLightDir(sampler.Get2D(dimension, first_index + i)), lit, sampler);
+    if (lit) lit_count++;
+  }
 
-  for (int i = 0; i < light_samples_; ++i) {
-    Ray ray;
-    ray.origin = info.pos;
-    ray.dir = -directional_dir_samples_[i];
-    ray.ignored_index_ = info.geometry_index_;
-    //Diffuse
-    RayInfo result = ComputeRay(ray, 0);
+  unsigned int taken = probes;
+  if (lit_count != 0 && lit_count != probes) {
+    for (unsigned int i = probes; i < frame_.light_samples_; ++i) {
+      bool lit;
+      total_light_ += ComputeLightSample(info, SampleLightDir(sampler.Get2D(dimension, first_index + i)), lit, sampler);
+    }
+    taken = frame_.light_samples_;
+  }
+
+  total_light_ /= (float)taken;
+
+  //Point lights
+  if (frame_.lights_.size() <= frame_.many_lights_threshold_) {
+    for (unsigned int i = 0; i < frame_.lights_.size(); ++i) {
+      if (!run) {
+        total_light_ += ComputePointLight(info, frame_.lights_[i], sampler);
+        continue;
+      }
+      PointLightSetup setup;
+      setup.to_light = glm::vec3(run->to_x[i][pixel], run->to_y[i][pixel], run->to_z[i][pixel]);
+      setup.dir = glm::vec3(run->dir_x[i][pixel], run->dir_y[i][pixel], run->dir_z[i][pixel]);
+      setup.dist2 = run->dist2[i][pixel];
+      setup.diffuse = run->diffuse[i][pixel];
+      total_light_ += ShadePointLight(info, frame_.lights_[i], setup, sampler);
+    }
+  } else if (frame_.many_lights_samples_ > 0) {
+    //Too many to shade all of them, pick a few through the light tree and
+    //weight them by the probability of being picked
+    unsigned int light_dimension = sampler.NextDimension();
+    for (unsigned int i = 0; i < frame_.many_lights_samples_; ++i) {
+      float pdf;
+      float u = sampler.Get2D(light_dimension, sampler.sample_index() * frame_.many_lights_samples_ + i).x;
+      int light = light_tree_.Sample(info.pos, info.normal, u, pdf);
+      if (light < 0 || pdf <= 0.0f) continue;
+      total_light_ += ComputePointLight(info, frame_.lights_[light], sampler) / (pdf * frame_.many_lights_samples_);
+    }
+  }
 
-    float diffuse_strength = 0.0f;
-    float specular_strength = 0.0f;
-    if (result.dist == -1) { //if collision then shadow
-      diffuse_strength = glm::max(glm::dot(info.normal, -directional_dir_samples_[i]), 0.0f) * directional_inrtensity_;
+  return total_light_;
+}
 
-      glm::vec3 viewDir = glm::normalize(camera_.pos - info.pos);
-      glm::vec3 reflectDir = glm::reflect(directional_dir_samples_[i], info.normal);
-      specular_strength = glm::pow(glm::max(glm::dot(viewDir, reflectDir), 0.0f), 64) * directional_inrtensity_;
+glm::vec3 Renderer::ComputePointLight(const RayInfo& info, const Light& light, Sampler& sampler){
+  PointLightSetup setup;
+  setup.to_light = light.pos - info.pos;
+  setup.dist2 = glm::dot(setup.to_light, setup.to_light);
+  setup.dir = setup.to_light / glm::sqrt(setup.dist2);
+  setup.diffuse = glm::dot(info.normal, setup.dir);
+  return ShadePointLight(info, light, setup, sampler);
+}
 
+void Renderer::SetupPointLights(const GBufferLayer& layer, size_t first, unsigned int count,
+  const std::vector<Light>& lights, PointLightRun& run){
+  //Same operations in the same order as ComputePointLight, so both give
+  //the same bits
+  const float* pos_x = &layer.pos_x[first];
+  const float* pos_y = &layer.pos_y[first];
+  const float* pos_z = &layer.pos_z[first];
+  const float* normal_x = &layer.normal_x[first];
+  const float* normal_y = &layer.normal_y[first];
+  const float* normal_z = &layer.normal_z[first];
+  for (unsigned int l = 0; l < lights.size(); ++l) {
+    const glm::vec3& light = lights[l].pos;
+    unsigned int i = 0;
+#ifdef RENDERER_SSE2
+    const __m128 light_x = _mm_set1_ps(light.x);
+    const __m128 light_y = _mm_set1_ps(light.y);
+    const __m128 light_z = _mm_set1_ps(light.z);
+    for (; i + 4 <= count; i += 4) {
+      __m128 to_x = _mm_sub_ps(light_x, _mm_loadu_ps(pos_x + i));
+      __m128 to_y = _mm_sub_ps(light_y, _mm_loadu_ps(pos_y + i));
+      __m128 to_z = _mm_sub_ps(light_z, _mm_loadu_ps(pos_z + i));
+      __m128 dist2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(to_x, to_x), _mm_mul_ps(to_y, to_y)), _mm_mul_ps(to_z, to_z));
+      __m128 length = _mm_sqrt_ps(dist2);
+      __m128 dir_x = _mm_div_ps(to_x, length);
+      __m128 dir_y = _mm_div_ps(to_y, length);
+      __m128 dir_z = _mm_div_ps(to_z, length);
+      __m128 diffuse = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(normal_x + i), dir_x),
+        _mm_mul_ps(_mm_loadu_ps(normal_y + i), dir_y)), _mm_mul_ps(_mm_loadu_ps(normal_z + i), dir_z));
+      _mm_storeu_ps(run.to_x[l] + i, to_x);
+      _mm_storeu_ps(run.to_y[l] + i, to_y);
+      _mm_storeu_ps(run.to_z[l] + i, to_z);
+      _mm_storeu_ps(run.dir_x[l] + i, dir_x);
+      _mm_storeu_ps(run.dir_y[l] + i, dir_y);
+      _mm_storeu_ps(run.dir_z[l] + i, dir_z);
+      _mm_storeu_ps(run.dist2[l] + i, dist2);
+      _mm_storeu_ps(run.diffuse[l] + i, diffuse);
+    }
+#endif
+    for (; i < count; ++i) {
+      glm::vec3 to_light = light - glm::vec3(pos_x[i], pos_y[i], pos_z[i]);
+      float dist2 = glm::dot(to_light, to_light);
+      glm::vec3 dir = to_light / glm::sqrt(dist2);
+      run.to_x[l][i] = to_light.x;
+      run.to_y[l][i] = to_light.y;
+      run.to_z[l][i] = to_light.z;
+      run.dir_x[l][i] = dir.x;
+      run.dir_y[l][i] = dir.y;
+      run.dir_z[l][i] = dir.z;
+      run.dist2[l][i] = dist2;
+      run.diffuse[l][i] = glm::dot(glm::vec3(normal_x[i], normal_y[i], normal_z[i]), dir);
     }
-
-    total_light_ += info.color * 0.2f + diffuse_strength * geometries[info.geometry_index_]->diffuse_
-      + specular_strength * geometries[info.geometry_index_]->specular_;
   }
+}
 
+glm::vec3 Renderer::ShadePointLight(const RayInfo& info, const Light& light, const PointLightSetup& setup,
+  Sampler& sampler){
+  float diffuse_strength = setup.diffuse;
+  if (diffuse_strength <= 0.0f) return glm::vec3(0.0f, 0.0f, 0.0f);
+
+  //Not normalized, anything hit before 1.0 is between the point and the light
+  Ray ray;
+  ray.origin = info.pos;
+  ray.dir = setup.to_light;
+  ray.ignored_index_ = info.geometry_index_;
+  RayInfo result = ComputeRay(ray, 0, sampler);
+  if (result.dist != -1 && result.dist < 1.0f) return glm::vec3(0.0f, 0.0f, 0.0f);
+
+  glm::vec3 viewDir = glm::normalize(frame_.camera_.pos - info.pos);
+  glm::vec3 reflectDir = glm::reflect(-setup.dir, info.normal);
+  float specular_strength = glm::pow(glm::max(glm::dot(viewDir, reflectDir), 0.0f), 64);
+
+  return light.color * (light.intensity / setup.dist2) *
+    (diffuse_strength * records().material(info.geometry_index_).diffuse +
+      specular_strength * records().material(info.geometry_index_).specular);
+}
 
-  total_light_ /= light_samples_;
-
-  return total_light_;
+glm::vec3 Renderer::SampleLightDir(glm::vec2 u){
+  glm::vec2 disk = ConcentricDisk(u) * frame_.light_offset_;
+  return glm::normalize(light_dir_ + light_tangent_ * disk.x + light_bitangent_ * disk.y);
 }
 
-RayInfo Renderer::ComputeRay(Ray& ray, int depth){
+RayInfo Renderer::ComputeRay(Ray& ray, int depth, Sampler& sampler){
   
-  float distance_ = 99999999.f;
-  glm::vec3 last_pos = { 0.0f,0.0f,0.0f };
-  glm::vec3 normal = { 0.0f,0.0f,0.0f };
-  glm::vec3 color_ = { 0.0f,0.0f,0.0f };
+  //Only the compact records are walked, the geometry itself is only read
+  //for the normal of the closest hit
   int geo_index_;
-  for (int k = 0; k < geometries.size(); ++k) {
-    if (k == ray.ignored_index_) continue;
-    float result = geometries[k]->ComputeRay(ray);
-    if (result == -1) continue;
-    
-    if (result < distance_ && result > 0) { //Intersected with a closer object
-      distance_ = result;
-      normal = geometries[k]->GetNormal(ray.at(result));
-      color_ = geometries[k]->color_;
-      last_pos = ray.at(result);
-      geo_index_ = k;
-    }
-  }
+  float distance_ = records().Intersect(ray, &geo_index_);
+  t_rays_traced++;
 
   RayInfo out_var;
 
-  if (distance_ >= 99999997.f) {
+  if (geo_index_ < 0) {
     out_var.dist = -1;
     return out_var;
   }
-    
+
+  glm::vec3 last_pos = ray.at(distance_);
+  const Material& material = records().material(geo_index_);
   out_var.dist = distance_;
   out_var.pos = last_pos;
-  out_var.normal = normal;
+  out_var.normal = frame_.geometries[geo_index_]->GetNormal(last_pos);
   out_var.geometry_index_ = geo_index_;
 
-  out_var.color = color_;
+  out_var.color = material.color;
   
   if (depth <= 0)
     return out_var;
   //Reflectance
 
-  if (geometries[geo_index_]->specular_ > 0.0f) {
+  glm::vec3 normal = out_var.normal;
+  if (material.specular > 0.0f) {
     Ray reflect;
     reflect.origin = last_pos;
     reflect.ignored_index_ = geo_index_;
     reflect.dir = glm::reflect(ray.dir, normal);
 
-    RayInfo reflection = ComputeRay(reflect, 0);
+    RayInfo reflection = ComputeRay(reflect, 0, sampler);
     if (reflection.dist > -1.0f) {
-      out_var.color += ComputeLighting(reflection) * geometries[geo_index_]->specular_;
+      out_var.color += ComputeLighting(reflection, sampler) * material.specular;
     } else {
-      out_var.color += BackgroundColor(reflect) * geometries[geo_index_]->specular_ ;
+      out_var.color += BackgroundColor(reflect) * material.specular;
 
     }
   }
@@ -178,93 +448,1170 @@ RayInfo Renderer::ComputeRay(Ray& ray, int depth){
 }
 
 void Renderer::Update() {
+  WaitIdle();
+  if (target_frame_ms_ > 0.0f) render_scale_ = adapted_render_scale_;
+  frame_ = *this;
+  frame_geometry_dirty_ = geometry_dirty_;
+  geometry_dirty_ = false;
+  RenderFrame(screen_, false, &frame_stats_);
+}
+
+void Renderer::BeginFrame() {
+  BeginFrame(nullptr);
+}
+
+void Renderer::BeginFrame(TScreen* output) {
+  if (slots_.size() != frame_latency_ + 1) {
+    //Frames still queued would use the old ring
+    WaitIdle();
+    frames_presented_ = frames_submitted_;
+    slots_.clear();
+    slots_.resize(frame_latency_ + 1);
+  }
+
+  //The slot is free once its last frame was presented. If EndFrame wasn't
+  //called that frame is dropped.
+  if (frames_submitted_ - frames_presented_ >= slots_.size()) {
+    schd.waitFor(slots_[frames_presented_ % slots_.size()].done);
+    frames_presented_++;
+  }
+
+  unsigned int slot_index = frames_submitted_ % slots_.size();
+  FrameSlot& slot = slots_[slot_index];
+  slot.target = output ? output : &slot.output;
+  if (!output && (slot.output.width != screen_->width || slot.output.height != screen_->height)) {
+    ReallocateUntouched(slot.pixels, (size_t)screen_->width * screen_->height);
+    slot.new_pixels = true;
+    slot.output.width = screen_->width;
+    slot.output.height = screen_->height;
+    slot.output.stride = screen_->width;
+    slot.output.pixels = slot.pixels.data();
+  }
+
+  //The dynamic resolution runs on the frames, the latest value is the
+  //starting point of the next one
+  if (target_frame_ms_ > 0.0f) render_scale_ = adapted_render_scale_;
+  slot.settings = *this;
+  slot.geometry_dirty = geometry_dirty_;
+  geometry_dirty_ = false;
+
+  //One frame at a time, its passes spread over the workers
+  slot.renderer = this;
+  px_sched::Job job = { &Renderer::FrameJob, &slot };
+  schd.runAfter(last_frame_, job, &slot.done);
+  last_frame_ = slot.done;
+  frames_submitted_++;
+}
+
+void Renderer::FrameJob(void* arg){
+  FrameSlot& slot = *(FrameSlot*)arg;
+  Renderer* renderer = slot.renderer;
+  renderer->frame_ = slot.settings;
+  renderer->frame_geometry_dirty_ = slot.geometry_dirty;
+  renderer->RenderFrame(slot.target, slot.new_pixels && slot.target == &slot.output, &slot.stats);
+  slot.new_pixels = false;
+}
+
+const TScreen* Renderer::EndFrame() {
+  if (frames_submitted_ - frames_presented_ <= frame_latency_) return nullptr;
+
+  FrameSlot& slot = slots_[frames_presented_ % slots_.size()];
+  schd.waitFor(slot.done);
+  frames_presented_++;
+  frame_stats_ = slot.stats;
+  return slot.target;
+}
+
+void Renderer::WaitIdle() {
+  //Finished frames can still be returned by EndFrame
+  for (unsigned int i = frames_presented_; i != frames_submitted_; ++i) {
+    schd.waitFor(slots_[i % slots_.size()].done);
+  }
+}
+
+void Renderer::RenderFrame(TScreen* output, bool new_output, FrameStats* stats) {
   MTR_BEGIN("Render", "MainCore");
-  while (screen_->height % num_threads_ != 0) {
-    num_threads_++;
-  }
-  int step = screen_->height / num_threads_;
-
-  int base_pos_ = 0;
-  int end_pos = step;
-  //Offset for softer shadows
-  directional_dir_samples_[0] = {
-    directional_dir_.x + light_offset_,
-      directional_dir_.y,
-      directional_dir_.z };
-  directional_dir_samples_[1] = {
-  directional_dir_.x - light_offset_,
-    directional_dir_.y,
-    directional_dir_.z };
-
-  lower_left_corner = camera_.pos -
-    horizontal / 2.0f - vertical / 2.0f - glm::vec3(0, 0, camera_.focal_length);
-  
-  schd.run([this, base_pos_, end_pos] {UpdateStep(base_pos_, end_pos, 0); }, &sync_obj);
+  auto frame_start = std::chrono::high_resolution_clock::now();
+  //Nothing of the last frame is running anymore
+  arena_.Reset();
+  submitted_jobs_ = 0;
+  submit_ms_ = 0.0f;
+  rays_traced_ = 0;
+  output_ = output;
+  SetupRenderTarget();
+  //The upscale writes every pixel of a scaled output, only a target the
+  //tiles write to is cleared by them
+  if (new_output && target_ == output_) first_touch_ |= kTouchTarget;
+
+  //Basis of the soft shadow disk
+  light_dir_ = glm::normalize(frame_.directional_dir_);
+  glm::vec3 axis = glm::abs(light_dir_.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+  light_tangent_ = glm::normalize(glm::cross(axis, light_dir_));
+  light_bitangent_ = glm::cross(light_dir_, light_tangent_);
+  if (frame_.light_samples_ < 1) frame_.light_samples_ = 1;
+
+  frame_changes_ = DetectChanges();
+  //The tree only depends on the point lights, most frames keep the last one
+  if (frame_.lights_.size() > frame_.many_lights_threshold_ &&
+    ((frame_changes_ & kChangeLight) || light_tree_.empty())) {
+    light_tree_.Build(frame_.lights_);
+  }
+
+  //The camera can change between frames, a reloaded scene brings its own
+  horizontal = glm::vec3(frame_.camera_.u, 0, 0);
+  vertical = -glm::vec3(0.0f, frame_.camera_.v, 0.0f);
+  lower_left_corner = frame_.camera_.pos -
+    horizontal / 2.0f - vertical / 2.0f - glm::vec3(0, 0, frame_.camera_.focal_length);
+
+  hit_records_.Build(frame_.geometries, arena_.Allocate<HitRecord>(frame_.geometries.size()),
+    (frame_changes_ & kChangeGeometry) != 0);
+  //Only worth it when the workers are pinned to more than one node
+  replicate_records_ = pinned_workers_ > 0 && topology_.numa_nodes > 1;
+  for (unsigned int node = 0; node < kMaxNodeQueues; ++node) {
+    node_records_state_[node] = kRecordsMissing;
+  }
+  BuildTiles();
+  edge_pixels_ = 0;
+  if (target_ != output_) {
+    scaler_.Setup(target_->width, target_->height, output_->width, output_->height);
+  }
+  tonemapper_.Setup(frame_.tone_curve_, frame_.exposure_, frame_.srgb_output_, frame_.dither_);
+  PartitionTiles();
+
+  size_t pixel_count = (size_t)target_->width * target_->height;
+  if (accumulation_.size() != pixel_count) {
+    ReallocateUntouched(accumulation_, pixel_count);
+    first_touch_ |= kTouchAccumulation;
+    frame_changes_ |= kChangeScreen;
+  }
+
+  //Keep adding samples while nothing moves, any change starts again
+  if (frame_.progressive_ && frame_changes_ == kChangeNone) {
+    accumulated_frames_++;
+  } else {
+    accumulated_frames_ = 0;
+  }
+
+  if (frame_.deferred_shading_) {
+    if (gbuffer_.width != target_->width || gbuffer_.height != target_->height) {
+      gbuffer_.Resize(target_->width, target_->height);
+      first_touch_ |= kTouchGBuffer;
+      gbuffer_valid_ = false;
+    }
+    //Reproject swaps them with the current ones, they are allocated here so
+    //the workers clear them too. Not reprojected the first frame they exist.
+    bool new_history = false;
+    if (frame_.temporal_reprojection_ &&
+      (history_gbuffer_.width != target_->width || history_gbuffer_.height != target_->height)) {
+      history_gbuffer_.Resize(target_->width, target_->height);
+      ReallocateUntouched(history_accumulation_, pixel_count);
+      ReallocateUntouched(reproject_keys_, pixel_count);
+      first_touch_ |= kTouchHistory;
+      new_history = true;
+    }
+
+    //When only the lighting changed the hits of the last frame are still
+    //valid, only shadow rays and shading have to run again. Accumulated
+    //frames need new jittered hits.
+    hits_reused_ = gbuffer_valid_ && gbuffer_complete_ && !frame_.checkerboard_ && accumulated_frames_ == 0 &&
+      (frame_changes_ & (kChangeCamera | kChangeGeometry | kChangeScreen)) == 0;
+
+    //Only the camera moved, last frame's hits are moved to their new pixels
+    //and only the ones that couldn't be reused are traced
+    use_pixel_plan_ = false;
+    reused_pixels_ = 0;
+    if (frame_.temporal_reprojection_ && gbuffer_valid_ && !new_history && frame_changes_ == kChangeCamera) {
+      Reproject();
+      use_pixel_plan_ = true;
+    }
+    if (frame_.checkerboard_) {
+      PlanCheckerboard(use_pixel_plan_);
+      use_pixel_plan_ = true;
+    }
+
+    //A tile is shaded by the worker that traced it, right after. The
+    //checkerboard reconstruction reads the neighbour tiles, so it waits
+    //for all of them and feeds the upscale instead.
+    TileStep trace = hits_reused_ ? nullptr : &Renderer::TraceStep;
+    if (frame_.checkerboard_) {
+      DispatchTiles(trace, &Renderer::ShadeStep);
+      BuildBandGraph();
+      DispatchTiles(&Renderer::ReconstructStep, nullptr);
+    } else {
+      BuildBandGraph();
+      DispatchTiles(trace, &Renderer::ShadeStep);
+    }
+    if (!hits_reused_) {
+      gbuffer_valid_ = true;
+      gbuffer_complete_ = !use_pixel_plan_;
+    }
+  } else {
+    hits_reused_ = false;
+    use_pixel_plan_ = false;
+    gbuffer_complete_ = false;
+    reused_pixels_ = 0;
+    gbuffer_valid_ = false;
+    if (frame_.checkerboard_) {
+      PlanCheckerboard(false);
+      use_pixel_plan_ = true;
+      DispatchTiles(&Renderer::UpdateStep, nullptr);
+      BuildBandGraph();
+      DispatchTiles(&Renderer::ReconstructStep, nullptr);
+    } else {
+      BuildBandGraph();
+      DispatchTiles(&Renderer::UpdateStep, nullptr);
+    }
+  }
+  CollectTileTimes();
+  arena_bytes_ = arena_.bytes();
+  arena_allocations_ = arena_.allocations();
+  arena_fallbacks_ = arena_.fallbacks();
+  frame_rays_ = rays_traced_;
+
+  stats->frame_changes = frame_changes_;
+  stats->work_items = (unsigned int)work_items_.size();
+  stats->hits_reused = hits_reused_;
+  stats->accumulated_frames = accumulated_frames_;
+  stats->reused_pixels = reused_pixels_;
+  stats->edge_pixels = edge_pixels_;
+  stats->rays_traced = frame_rays_;
+  stats->submitted_jobs = submitted_jobs_;
+  stats->submit_ms = submit_ms_;
+  stats->arena_bytes = arena_bytes_;
+  stats->arena_allocations = arena_allocations_;
+  stats->arena_fallbacks = arena_fallbacks_;
+
+  frame_index_++;
+
+  std::chrono::duration<float, std::milli> frame_time = std::chrono::high_resolution_clock::now() - frame_start;
+  UpdateRenderScale(frame_time.count());
+  adapted_render_scale_ = frame_.render_scale_;
+  MTR_END("Render", "MainCore");
+
+}
+
+//Reprojected hits are packed as depth bits over the source pixel. The
+//depth is positive, so its bits order like the floats and the smallest key
+//is the nearest hit, the lowest source on a tie.
+static const unsigned long long kNoReprojection = ~0ull;
+
+static inline unsigned long long ReprojectKey(float depth, unsigned int src) {
+  unsigned int bits;
+  memcpy(&bits, &depth, sizeof(bits));
+  return ((unsigned long long)bits << 32) | src;
+}
+
+static inline float ReprojectDepth(unsigned long long key) {
+  unsigned int bits = (unsigned int)(key >> 32);
+  float depth;
+  memcpy(&depth, &bits, sizeof(depth));
+  return depth;
+}
+
+void Renderer::Reproject(){
+  MTR_SCOPE("Render", "Reproject");
+  size_t pixel_count = (size_t)target_->width * target_->height;
+
+  //Last frame becomes the history, the current buffers are rebuilt from it.
+  //RenderFrame allocated the history at this size.
+  std::swap(gbuffer_, history_gbuffer_);
+  std::swap(accumulation_, history_accumulation_);
+  pixel_plan_.resize(pixel_count);
+
+  //Old hits land anywhere, so every pass waits for the one before
+  DispatchTiles(&Renderer::ReprojectClearStep, nullptr);
+  DispatchTiles(&Renderer::ReprojectScatterStep, nullptr);
+  DispatchTiles(&Renderer::ReprojectPlanStep, nullptr);
+}
+
+void Renderer::ReprojectClearStep(const Tile& tile, int /*thread*/){
+  size_t width = target_->width;
+  for (int i = tile.y0; i < tile.y1; ++i) {
+    for (size_t index = (size_t)i * width + tile.x0; index < (size_t)i * width + tile.x1; ++index) {
+      reproject_keys_[index].store(kNoReprojection, std::memory_order_relaxed);
+    }
+  }
+}
+
+void Renderer::ReprojectScatterStep(const Tile& tile, int /*thread*/){
+  MTR_SCOPE("Render", "ReprojectScatterStep");
+  unsigned int width = target_->width;
+  unsigned int height = target_->height;
+
+  //Scatter every old hit of the tile to the pixel it lands on now, nearest
+  //one wins. The camera only translates, so a point is projected to the
+  //z = -focal plane and the primary ray parameter is its depth over the
+  //focal length.
+  const GBufferLayer& old = history_gbuffer_.primary;
+  const FirstTouchVector<unsigned char>& old_reconstructed = history_gbuffer_.reconstructed;
+  float half_u = frame_.camera_.u * 0.5f;
+  float half_v = frame_.camera_.v * 0.5f;
+  for (int i = tile.y0; i < tile.y1; ++i) {
+    size_t src = (size_t)i * width + tile.x0;
+    for (int j = tile.x0; j < tile.x1; ++j, ++src) {
+      if (old.depth[src] == -1.0f || old_reconstructed[src]) continue;
+
+      glm::vec3 d = glm::vec3(old.pos_x[src], old.pos_y[src], old.pos_z[src]) - frame_.camera_.pos;
+      if (d.z > -0.0001f) continue; //Behind the camera
+      float t = -d.z / frame_.camera_.focal_length;
+      float u = (d.x / t + half_u) / frame_.camera_.u;
+      float v = (half_v - d.y / t) / frame_.camera_.v;
+      int x = (int)(u * (width - 1) + 0.5f);
+      int y = (int)(v * (height - 1) + 0.5f);
+      if (x < 0 || y < 0 || x >= (int)width || y >= (int)height) continue;
+
+      std::atomic<unsigned long long>& target = reproject_keys_[(size_t)y * width + x];
+      unsigned long long key = ReprojectKey(t, (unsigned int)src);
+      unsigned long long current = target.load(std::memory_order_relaxed);
+      while (key < current && !target.compare_exchange_weak(current, key, std::memory_order_relaxed)) {}
+    }
+  }
+}
+
+void Renderer::ReprojectPlanStep(const Tile& tile, int /*thread*/){
+  MTR_SCOPE("Render", "ReprojectPlanStep");
+  unsigned int width = target_->width;
+  unsigned int height = target_->height;
+  const GBufferLayer& old = history_gbuffer_.primary;
+  const HitRecords& hit_records = records();
+
+  //Holes are disocclusions (or sky), neighbours with a different geometry,
+  //depth or normal mean the pixel is on an edge and may mix surfaces, both
+  //are traced. So are specular surfaces, their highlights and reflections
+  //change with the view.
+  //A rotating quarter of the valid pixels is traced too and added to their
+  //history so it keeps getting new samples while moving.
+  unsigned int refresh = frame_index_ % 4;
+  unsigned int reused = 0;
+  for (int y = tile.y0; y < tile.y1; ++y) {
+    size_t dst = (size_t)y * width + tile.x0;
+    for (int x = tile.x0; x < tile.x1; ++x, ++dst) {
+      gbuffer_.reconstructed[dst] = 0;
+      unsigned long long key = reproject_keys_[dst].load(std::memory_order_relaxed);
+      if (key == kNoReprojection) {
+        pixel_plan_[dst] = kPixelTrace;
+        continue;
+      }
+
+      size_t src = (size_t)(key & 0xFFFFFFFFu);
+      float depth = ReprojectDepth(key);
+      int geometry = old.geometry_index[src];
+      glm::vec3 normal(old.normal_x[src], old.normal_y[src], old.normal_z[src]);
+      unsigned char plan = ((x & 1) + 2 * (y & 1)) == (int)refresh ? kPixelRefresh : kPixelReuse;
+      if (hit_records.material(geometry).specular > 0.0f) plan = kPixelTrace;
+      int neighbours[4][2] = { {-1, 0}, {1, 0}, {0, -1}, {0, 1} };
+      for (int n = 0; n < 4 && plan != kPixelTrace; ++n) {
+        int nx = x + neighbours[n][0];
+        int ny = y + neighbours[n][1];
+        if (nx < 0 || ny < 0 || nx >= (int)width || ny >= (int)height) continue;
+        unsigned long long neighbour_key = reproject_keys_[(size_t)ny * width + nx].load(std::memory_order_relaxed);
+        if (neighbour_key == kNoReprojection) continue;
+
+        size_t neighbour_src = (size_t)(neighbour_key & 0xFFFFFFFFu);
+        glm::vec3 neighbour_normal(old.normal_x[neighbour_src], old.normal_y[neighbour_src], old.normal_z[neighbour_src]);
+        if (old.geometry_index[neighbour_src] != geometry ||
+          glm::abs(ReprojectDepth(neighbour_key) - depth) > frame_.reprojection_depth_tolerance_ * depth ||
+          glm::dot(normal, neighbour_normal) < 0.8f) {
+          plan = kPixelTrace;
+        }
+      }
+
+      pixel_plan_[dst] = plan;
+      if (plan == kPixelTrace) continue;
+
+      gbuffer_.primary.Copy(dst, old, src);
+      gbuffer_.primary.depth[dst] = depth;
+      gbuffer_.reflection.Copy(dst, history_gbuffer_.reflection, src);
+
+      //Cap the history so new samples still have some weight
+      glm::vec4 history = history_accumulation_[src];
+      if (history.w > kMaxHistorySamples) history *= kMaxHistorySamples / history.w;
+      accumulation_[dst] = history;
+      reused++;
+    }
+  }
+  reused_pixels_ += reused;
+}
+
+void Renderer::PlanCheckerboard(bool reprojected){
+  MTR_SCOPE("Render", "PlanCheckerboard");
+  unsigned int width = target_->width;
+  unsigned int height = target_->height;
+  pixel_plan_.resize((size_t)width * height);
+
+  //Still views keep the other half from the last frame, otherwise it is
+  //rebuilt from the traced neighbours (or taken from the reprojection)
+  bool still = frame_changes_ == kChangeNone;
+  unsigned char traced_plan = (still && frame_.progressive_) ? kPixelRefresh : kPixelTrace;
+
+  for (unsigned int y = 0; y < height; ++y) {
+    size_t index = (size_t)y * width;
+    for (unsigned int x = 0; x < width; ++x, ++index) {
+      bool traced_half = ((x + y + frame_index_) & 1) == 0;
+      unsigned char plan = reprojected ? pixel_plan_[index] : traced_plan;
+
+      if (!traced_half) {
+        if (still || plan != kPixelTrace) {
+          plan = kPixelReuse;
+        } else {
+          plan = kPixelReconstruct;
+        }
+      }
+      pixel_plan_[index] = plan;
+    }
+  }
+}
+
+void Renderer::SetTargetFrameTime(float milliseconds){
+  target_frame_ms_ = milliseconds;
+  adapted_render_scale_ = render_scale_;
+}
+
+void Renderer::SetupRenderTarget(){
+  if (frame_.render_scale_ >= 1.0f) {
+    frame_.render_scale_ = 1.0f;
+    target_ = output_;
+    return;
+  }
+  if (frame_.render_scale_ < frame_.min_render_scale_) frame_.render_scale_ = frame_.min_render_scale_;
+
+  //Same aspect ratio as the screen, at least a few pixels
+  unsigned int width = (unsigned int)(output_->width * frame_.render_scale_ + 0.5f);
+  unsigned int height = (unsigned int)(output_->height * frame_.render_scale_ + 0.5f);
+  if (width < 16) width = 16;
+  if (height < 16) height = 16;
+
+  if (render_target_.width != width || render_target_.height != height) {
+    //Rows padded to whole cache lines and the buffer aligned to one, so a
+    //16 pixel wide tile row is exactly one line and tiles rendered by
+    //different threads never share one
+    unsigned int stride = (width + kPixelsPerCacheLine - 1) & ~(kPixelsPerCacheLine - 1);
+    ReallocateUntouched(render_pixels_, (size_t)stride * height + kPixelsPerCacheLine);
+    first_touch_ |= kTouchTarget;
+    edge_mask_.resize((size_t)width * height);
+    render_target_.width = width;
+    render_target_.height = height;
+    render_target_.stride = stride;
+  }
+  size_t misalignment = ((size_t)render_pixels_.data() / sizeof(unsigned int)) & (kPixelsPerCacheLine - 1);
+  render_target_.pixels = render_pixels_.data() + (misalignment ? kPixelsPerCacheLine - misalignment : 0);
+  target_ = &render_target_;
+}
+
+void Renderer::UpdateRenderScale(float frame_ms){
+  if (frame_.target_frame_ms_ != last_target_frame_ms_) {
+    last_target_frame_ms_ = frame_.target_frame_ms_;
+    frame_ms_average_ = 0.0f;
+    frames_under_budget_ = 0;
+  }
+  if (frame_.target_frame_ms_ <= 0.0f) return;
+
+  //Smoothed cost so a single slow frame doesn't change the resolution
+  if (frame_ms_average_ <= 0.0f) frame_ms_average_ = frame_ms;
+  frame_ms_average_ += (frame_ms - frame_ms_average_) * 0.2f;
+
+  //Cost grows with the pixel count, the square of the scale. Every change
+  //restarts the pixel history, so the scale drops as soon as the frame is
+  //over budget but only grows after a while comfortably under it.
+  float wanted = frame_.render_scale_ * glm::sqrt(frame_.target_frame_ms_ / frame_ms_average_);
+  wanted = glm::clamp(wanted, frame_.min_render_scale_, 1.0f);
+
+  if (frame_ms_average_ > frame_.target_frame_ms_ * 1.05f) {
+    frames_under_budget_ = 0;
+  } else if (frame_ms_average_ < frame_.target_frame_ms_ * 0.85f) {
+    frames_under_budget_++;
+    if (frames_under_budget_ < 10) return;
+    wanted = glm::min(wanted, frame_.render_scale_ * 1.1f);
+  } else {
+    frames_under_budget_ = 0;
+    return;
+  }
 
-  for (int i = 0; i < num_threads_; ++i) {
+  if (glm::abs(wanted - frame_.render_scale_) > 0.01f) {
+    frame_.render_scale_ = wanted;
+    frames_under_budget_ = 0;
+    //Measure the new resolution from scratch
+    frame_ms_average_ = 0.0f;
+  }
+}
+
+void Renderer::UpscaleStep(int startrow, int endrow, int /*thread*/){
+  MTR_SCOPE("Render", "UpscaleStep");
+  unsigned int* scratch = arena_.Allocate<unsigned int>(target_->width);
+  scaler_.ScaleRows(*target_, *output_, startrow, endrow, scratch);
+}
+
+static inline float Luminance(unsigned int argb) {
+  return (((argb >> 16) & 0xff) * 0.299f + ((argb >> 8) & 0xff) * 0.587f + (argb & 0xff) * 0.114f) * (1.0f / 255.0f);
+}
+
+void Renderer::EdgeMaskStep(int startrow, int endrow, int /*thread*/){
+  MTR_SCOPE("Render", "EdgeMaskStep");
+  int width = target_->width;
+  int height = target_->height;
+  //The G-buffer is only there in deferred mode, luminance works for both
+  bool use_gbuffer = frame_.deferred_shading_ && gbuffer_.width == target_->width && gbuffer_.height == target_->height;
+  const GBufferLayer& primary = gbuffer_.primary;
+
+  for (int i = startrow; i < endrow; ++i) {
+    const unsigned int* line = target_->pixels + i * target_->stride;
+    size_t index = (size_t)i * width;
+    for (int j = 0; j < width; ++j, ++index) {
+      float luminance = Luminance(line[j]);
+      int neighbours[4][2] = { {-1, 0}, {1, 0}, {0, -1}, {0, 1} };
+      unsigned char edge = 0;
+      for (int n = 0; n < 4 && !edge; ++n) {
+        int nx = j + neighbours[n][0];
+        int ny = i + neighbours[n][1];
+        if (nx < 0 || ny < 0 || nx >= width || ny >= height) continue;
+
+        if (glm::abs(Luminance(target_->pixels[ny * target_->stride + nx]) - luminance) > frame_.edge_luminance_threshold_) {
+          edge = 1;
+        } else if (use_gbuffer) {
+          size_t neighbour = (size_t)ny * width + nx;
+          //Interpolated pixels have no hit to compare, their luminance is enough
+          if (gbuffer_.reconstructed[index] || gbuffer_.reconstructed[neighbour]) continue;
+          float depth = primary.depth[index];
+          float neighbour_depth = primary.depth[neighbour];
+          if ((depth == -1.0f) != (neighbour_depth == -1.0f)) {
+            edge = 1;
+          } else if (depth != -1.0f && (primary.geometry_index[index] != primary.geometry_index[neighbour] ||
+            glm::abs(depth - neighbour_depth) > frame_.edge_depth_tolerance_ * depth)) {
+            edge = 1;
+          }
+        }
+      }
+      edge_mask_[index] = edge;
+    }
+  }
+}
+
+void Renderer::EdgeTraceStep(int startrow, int endrow, int /*thread*/){
+  MTR_SCOPE("Render", "EdgeTraceStep");
+  Sampler sampler;
+  sampler.Init(frame_.sampler_type_, frame_index_, startrow + 0x10000);
+
+  //A screen pixel is traced when any of the render pixels the scaler
+  //interpolated it from is on an edge
+  unsigned int traced = 0;
+
+  for (int i = startrow; i < endrow; ++i) {
+    const unsigned char* mask0 = &edge_mask_[(size_t)scaler_.source_row(i) * target_->width];
+    const unsigned char* mask1 = &edge_mask_[(size_t)scaler_.source_row_next(i) * target_->width];
+    unsigned int* out_line = output_->pixels + i * output_->stride;
+
+    for (unsigned int j = 0; j < output_->width; ++j) {
+      unsigned int x0 = scaler_.source_column(j);
+      unsigned int x1 = scaler_.source_column_next(j);
+      if (!(mask0[x0] | mask0[x1] | mask1[x0] | mask1[x1])) continue;
+
+      sampler.StartPixel(j, i, frame_index_);
+      Ray ray = PrimaryRay((float)j, (float)i, output_->width, output_->height);
+      RayInfo info = ComputeRay(ray, frame_.num_bounces_, sampler);
+      glm::vec3 color_;
+      if (info.dist != -1.0f)
+        color_ = ComputeLighting(info, sampler);
+      else color_ = BackgroundColor(ray);
+      out_line[j] = tonemapper_.ConvertPixel(color_, j, i);
+      traced++;
+    }
+  }
+
+  edge_pixels_ += traced;
+}
+
+void Renderer::MarkGeometryDirty(){
+  geometry_dirty_ = true;
+}
+
+unsigned int Renderer::DetectChanges(){
+  unsigned int changes = kChangeNone;
+
+  if (frame_.camera_.pos != last_camera_.pos || frame_.camera_.focal_length != last_camera_.focal_length ||
+    frame_.camera_.u != last_camera_.u || frame_.camera_.v != last_camera_.v ||
+    frame_.num_bounces_ != last_num_bounces_) {
+    changes |= kChangeCamera;
+  }
+
+  if (target_->width != last_width_ || target_->height != last_height_)
+    changes |= kChangeScreen;
+
+  if (frame_geometry_dirty_ || frame_.geometries != last_geometries_)
+    changes |= kChangeGeometry;
+
+  bool same_lights = frame_.lights_.size() == last_lights_.size();
+  for (unsigned int i = 0; i < frame_.lights_.size() && same_lights; ++i) {
+    same_lights = frame_.lights_[i].pos == last_lights_[i].pos &&
+      frame_.lights_[i].color == last_lights_[i].color &&
+      frame_.lights_[i].intensity == last_lights_[i].intensity;
+  }
+  if (!same_lights || frame_.directional_dir_ != last_directional_dir_ ||
+    frame_.directional_inrtensity_ != last_directional_intensity_ ||
+    frame_.light_samples_ != last_light_samples_ || frame_.light_offset_ != last_light_offset_) {
+    changes |= kChangeLight;
+  }
+
+  last_camera_ = frame_.camera_;
+  last_num_bounces_ = frame_.num_bounces_;
+  last_width_ = target_->width;
+  last_height_ = target_->height;
+  last_geometries_ = frame_.geometries;
+  last_lights_ = frame_.lights_;
+  last_directional_dir_ = frame_.directional_dir_;
+  last_directional_intensity_ = frame_.directional_inrtensity_;
+  last_light_samples_ = frame_.light_samples_;
+  last_light_offset_ = frame_.light_offset_;
+
+  return changes;
+}
+
+//Interleaves the bits of x and y, neighbouring tiles get close codes
+static unsigned int MortonCode(unsigned int x, unsigned int y) {
+  unsigned int code = 0;
+  for (unsigned int bit = 0; bit < 16; ++bit) {
+    code |= ((x >> bit) & 1) << (2 * bit);
+    code |= ((y >> bit) & 1) << (2 * bit + 1);
+  }
+  return code;
+}
+
+void Renderer::BuildTiles(){
+  if (frame_.tile_size_ < 4) frame_.tile_size_ = 4;
+  if (tiles_width_ == target_->width && tiles_height_ == target_->height && tiles_size_ == frame_.tile_size_) return;
+  tiles_width_ = target_->width;
+  tiles_height_ = target_->height;
+  tiles_size_ = frame_.tile_size_;
+
+  unsigned int columns = (target_->width + frame_.tile_size_ - 1) / frame_.tile_size_;
+  unsigned int rows = (target_->height + frame_.tile_size_ - 1) / frame_.tile_size_;
+  size_t count = (size_t)columns * rows;
+  std::pair<unsigned int, Tile>* ordered = arena_.Allocate<std::pair<unsigned int, Tile>>(count);
+  for (unsigned int y = 0; y < rows; ++y) {
+    for (unsigned int x = 0; x < columns; ++x) {
+      Tile tile;
+      tile.x0 = x * frame_.tile_size_;
+      tile.y0 = y * frame_.tile_size_;
+      tile.x1 = glm::min(tile.x0 + (int)frame_.tile_size_, (int)target_->width);
+      tile.y1 = glm::min(tile.y0 + (int)frame_.tile_size_, (int)target_->height);
+      ordered[(size_t)y * columns + x] = std::make_pair(MortonCode(x, y), tile);
+    }
+  }
+  std::sort(ordered, ordered + count,
+    [](const std::pair<unsigned int, Tile>& a, const std::pair<unsigned int, Tile>& b) { return a.first < b.first; });
+
+  tiles_.clear();
+  for (size_t i = 0; i < count; ++i) {
+    tiles_.push_back(ordered[i].second);
+  }
+  //No timings for the new tiles yet, the first frame goes in Morton order
+  tile_ms_.assign(tiles_.size(), 0.0f);
+}
 
+//Tiles this many times slower than the average are split
+static const float kSplitCostFactor = 4.0f;
 
-    base_pos_ += step;
-    end_pos += step;
-    if ((i+1) == num_threads_)
-      end_pos = screen_->height;
+void Renderer::PartitionTiles(){
+  work_items_.clear();
 
-    schd.run([this, base_pos_, end_pos, i] {UpdateStep(base_pos_, end_pos, i); }, &sync_obj);
+  float average_ms = 0.0f;
+  for (size_t i = 0; i < tile_ms_.size(); ++i) {
+    average_ms += tile_ms_[i];
   }
+  if (!tile_ms_.empty()) average_ms /= tile_ms_.size();
+
+  for (unsigned int i = 0; i < tiles_.size(); ++i) {
+    const Tile& tile = tiles_[i];
+    float predicted_ms = frame_.cost_balancing_ ? tile_ms_[i] : 0.0f;
+
+    //A tile much slower than the rest would be the last one running, its
+    //quarters can be spread over several workers
+    bool split = predicted_ms > average_ms * kSplitCostFactor &&
+      tile.x1 - tile.x0 >= 8 && tile.y1 - tile.y0 >= 8;
+    if (!split) {
+      WorkItem item = { tile, i, predicted_ms };
+      work_items_.push_back(item);
+      continue;
+    }
 
+    int mid_x = (tile.x0 + tile.x1) / 2;
+    int mid_y = (tile.y0 + tile.y1) / 2;
+    Tile quarters[4] = {
+      { tile.x0, tile.y0, mid_x, mid_y },
+      { mid_x, tile.y0, tile.x1, mid_y },
+      { tile.x0, mid_y, mid_x, tile.y1 },
+      { mid_x, mid_y, tile.x1, tile.y1 },
+    };
+    for (int q = 0; q < 4; ++q) {
+      WorkItem item = { quarters[q], i, predicted_ms * 0.25f };
+      work_items_.push_back(item);
+    }
+  }
+
+  //One queue per NUMA node, each a contiguous run of Morton tiles so a
+  //node keeps writing the same part of the buffers. Inside a queue the
+  //most expensive go first and the cheap ones fill the gaps at the end,
+  //equal costs keep the Morton order.
+  unsigned int queues = glm::min(glm::min(topology_.numa_nodes, kMaxNodeQueues), (unsigned int)tiles_.size());
+  if (queues == 0) queues = 1;
+  unsigned int tile_count = (unsigned int)tiles_.size();
+  bool cost_balancing = frame_.cost_balancing_;
+  std::stable_sort(work_items_.begin(), work_items_.end(),
+    [queues, tile_count, cost_balancing](const WorkItem& a, const WorkItem& b) {
+      unsigned int queue_a = (unsigned int)((unsigned long long)a.tile * queues / tile_count);
+      unsigned int queue_b = (unsigned int)((unsigned long long)b.tile * queues / tile_count);
+      if (queue_a != queue_b) return queue_a < queue_b;
+      return cost_balancing && a.predicted_ms > b.predicted_ms;
+    });
+
+  node_queues_ = queues;
+  unsigned int item = 0;
+  for (unsigned int queue = 0; queue < queues; ++queue) {
+    queue_begin_[queue] = item;
+    while (item < work_items_.size() &&
+      (unsigned long long)work_items_[item].tile * queues / tile_count == queue) {
+      item++;
+    }
+    queue_end_[queue] = item;
+  }
+  work_item_ms_.assign(work_items_.size(), 0.0f);
+}
+
+void Renderer::CollectTileTimes(){
+  //Every pass of the frame adds to the item times, a tile costs the sum of
+  //its items
+  std::fill(tile_ms_.begin(), tile_ms_.end(), 0.0f);
+  for (size_t i = 0; i < work_items_.size(); ++i) {
+    tile_ms_[work_items_[i].tile] += work_item_ms_[i];
+  }
+}
+
+void Renderer::BuildBandGraph(){
+  //The pass after this one finishes the tiles, each is tonemapped and
+  //then feeds the upscale
+  tonemap_tiles_ = true;
+  feed_bands_ = false;
+  if (target_ == output_) return;
+  feed_bands_ = true;
+
+  //The upscale runs in bands, one per row of tiles, each as soon as the
+  //tiles it reads are done:
+  //  edge mask of band b <- tiles of rows b-1, b, b+1 (neighbour pixels)
+  //  upscale of band b   <- edge masks b and b+1, or without edges the
+  //                         tiles of rows b and b+1 (bilinear footprint)
+  //Every finished work item decrements the syncs that wait for its row.
+  unsigned int bands = (target_->height + frame_.tile_size_ - 1) / frame_.tile_size_;
+  bands_ = bands;
+  mask_ready_ = arena_.Allocate<px_sched::Sync>(bands);
+  upscale_ready_ = arena_.Allocate<px_sched::Sync>(bands);
+  band_rows_ = arena_.Allocate<unsigned int>(bands + 1);
+  for (unsigned int band = 0; band < bands; ++band) {
+    mask_ready_[band] = px_sched::Sync();
+    upscale_ready_[band] = px_sched::Sync();
+    band_rows_[band] = output_->height;
+  }
+  band_rows_[bands] = output_->height;
+  for (unsigned int y = output_->height; y-- > 0;) {
+    band_rows_[scaler_.source_row(y) / frame_.tile_size_] = y;
+  }
+  for (unsigned int band = bands; band-- > 0;) {
+    if (band_rows_[band] > band_rows_[band + 1]) band_rows_[band] = band_rows_[band + 1];
+  }
+
+  bool edges = frame_.edge_adaptive_upscale_;
+  for (size_t i = 0; i < work_items_.size(); ++i) {
+    unsigned int row = work_items_[i].rect.y0 / frame_.tile_size_;
+    for (unsigned int band = row > 0 ? row - 1 : 0; band <= row + (edges ? 1 : 0) && band < bands; ++band) {
+      schd.incrementSync(edges ? &mask_ready_[band] : &upscale_ready_[band]);
+    }
+  }
+  if (edges) {
+    for (unsigned int band = 0; band < bands; ++band) {
+      schd.incrementSync(&upscale_ready_[band]);
+      if (band + 1 < bands) schd.incrementSync(&upscale_ready_[band]);
+    }
+  }
+
+  for (unsigned int band = 0; band < bands; ++band) {
+    RenderTask* task = AcquireTask();
+    task->index = band;
+    if (edges) Submit(&Renderer::EdgeMaskJob, task, &mask_ready_[band]);
+    Submit(&Renderer::UpscaleJob, task, &upscale_ready_[band]);
+  }
+}
+
+void Renderer::EdgeMaskJob(void* arg){
+  RenderTask& task = *(RenderTask*)arg;
+  Renderer* renderer = task.renderer;
+  unsigned int band = task.index;
+  unsigned int start = band * renderer->frame_.tile_size_;
+  renderer->EdgeMaskStep(start, glm::min(start + renderer->frame_.tile_size_, renderer->target_->height), band);
+  renderer->schd.decrementSync(&renderer->upscale_ready_[band]);
+  if (band > 0) renderer->schd.decrementSync(&renderer->upscale_ready_[band - 1]);
+}
+
+void Renderer::UpscaleJob(void* arg){
+  MTR_SCOPE("Render", "Upscale");
+  RenderTask& task = *(RenderTask*)arg;
+  Renderer* renderer = task.renderer;
+  unsigned int begin = renderer->band_rows_[task.index];
+  unsigned int end = renderer->band_rows_[task.index + 1];
+  if (begin == end) return;
+  renderer->UpscaleStep(begin, end, task.index);
+  //Edges found at the render resolution are traced again at the screen
+  //resolution over the interpolated result
+  if (renderer->frame_.edge_adaptive_upscale_) {
+    t_hit_records = renderer->NodeRecords();
+    renderer->EdgeTraceStep(begin, end, task.index);
+    t_hit_records = nullptr;
+  }
+  renderer->rays_traced_ += t_rays_traced;
+  t_rays_traced = 0;
+}
+
+void Renderer::FeedBands(const WorkItem& item){
+  unsigned int bands = bands_;
+  unsigned int row = item.rect.y0 / frame_.tile_size_;
+  bool edges = frame_.edge_adaptive_upscale_;
+  for (unsigned int band = row > 0 ? row - 1 : 0; band <= row + (edges ? 1 : 0) && band < bands; ++band) {
+    schd.decrementSync(edges ? &mask_ready_[band] : &upscale_ready_[band]);
+  }
+}
+
+void Renderer::DispatchTiles(TileStep first, TileStep second) {
+  //Work items are claimed one by one in the order PartitionTiles left them.
+  //Workers start with the queue of their NUMA node and take from the
+  //others once it runs out, so all of them run out of work at about the
+  //same time. Both steps run on an item back to back, then the bands
+  //built by BuildBandGraph are told the item is done.
+  unsigned int item_count = (unsigned int)work_items_.size();
+  unsigned int workers = glm::min(workers_, item_count);
+  for (unsigned int queue = 0; queue < node_queues_; ++queue) {
+    queue_next_[queue] = queue_begin_[queue];
+  }
+  bool tonemap = tonemap_tiles_;
+  bool feed_bands = feed_bands_;
+  unsigned int first_touch = first_touch_;
+  tonemap_tiles_ = false;
+  feed_bands_ = false;
+  first_touch_ = 0;
+
+  for (unsigned int worker = 0; worker < workers; ++worker) {
+    RenderTask* task = AcquireTask();
+    task->first = first;
+    task->second = second;
+    task->index = worker;
+    task->first_touch = first_touch;
+    task->tonemap = tonemap;
+    task->feed_bands = feed_bands;
+    Submit(&Renderer::TileWorkerJob, task, nullptr);
+  }
+
+  //Also waits for the bands
   schd.waitFor(sync_obj);
-  MTR_END("Render", "MainCore");
+}
+
+void Renderer::TileWorkerJob(void* arg){
+  RenderTask& task = *(RenderTask*)arg;
+  Renderer* renderer = task.renderer;
+  unsigned int queues = renderer->node_queues_;
+  //Unpinned threads can run anywhere, spreading them by worker keeps them
+  //from all starting on the first queue
+  int node = CurrentThreadNode();
+  unsigned int home = (node >= 0 ? (unsigned int)node : task.index) % queues;
+  t_hit_records = renderer->NodeRecords();
+  for (unsigned int i = 0; i < queues; ++i) {
+    unsigned int queue = (home + i) % queues;
+    for (;;) {
+      unsigned int item = renderer->queue_next_[queue].fetch_add(1);
+      if (item >= renderer->queue_end_[queue]) break;
+      const WorkItem& work = renderer->work_items_[item];
+      if (task.first_touch) renderer->FirstTouchStep(work.rect, task.first_touch);
+      auto start = std::chrono::high_resolution_clock::now();
+      if (task.first) (renderer->*task.first)(work.rect, task.index);
+      if (task.second) (renderer->*task.second)(work.rect, task.index);
+      if (task.tonemap) renderer->TonemapStep(work.rect, task.index);
+      std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+      //Only this worker has the item, no need to synchronize
+      renderer->work_item_ms_[item] += elapsed.count();
+      if (task.feed_bands) renderer->FeedBands(work);
+    }
+  }
+  renderer->rays_traced_ += t_rays_traced;
+  t_rays_traced = 0;
+  t_hit_records = nullptr;
+}
 
+void Renderer::FirstTouchStep(const Tile& tile, unsigned int buffers){
+  MTR_SCOPE("Render", "FirstTouchStep");
+  //Pages shared with a tile of another node end up on whichever clears first
+  size_t width = target_->width;
+  for (int i = tile.y0; i < tile.y1; ++i) {
+    size_t begin = (size_t)i * width + tile.x0;
+    size_t end = (size_t)i * width + tile.x1;
+    if (buffers & kTouchAccumulation) {
+      std::fill(accumulation_.begin() + begin, accumulation_.begin() + end, glm::vec4(0.0f));
+    }
+    if (buffers & kTouchGBuffer) gbuffer_.Clear(begin, end);
+    if (buffers & kTouchHistory) {
+      history_gbuffer_.Clear(begin, end);
+      std::fill(history_accumulation_.begin() + begin, history_accumulation_.begin() + end, glm::vec4(0.0f));
+    }
+    if (buffers & kTouchTarget) {
+      unsigned int* row = target_->pixels + i * target_->stride;
+      std::fill(row + tile.x0, row + tile.x1, 0u);
+    }
+  }
+}
+
+const HitRecords& Renderer::records() const {
+  return t_hit_records ? *t_hit_records : hit_records_;
+}
+
+const HitRecords* Renderer::NodeRecords(){
+  int node = CurrentThreadNode();
+  if (!replicate_records_ || node < 0 || node >= (int)kMaxNodeQueues) return nullptr;
+  std::atomic<unsigned int>& state = node_records_state_[node];
+  unsigned int expected = kRecordsMissing;
+  if (state.compare_exchange_strong(expected, kRecordsBuilding)) {
+    node_records_[node].Replicate(hit_records_);
+    state = kRecordsReady;
+    return &node_records_[node];
+  }
+  return expected == kRecordsReady ? &node_records_[node] : nullptr;
 }
 
-void Renderer::UpdateStep(int startrow, int endrow, int thread){
+Renderer::RenderTask* Renderer::AcquireTask(){
+  RenderTask* task = arena_.Allocate<RenderTask>(1);
+  task->renderer = this;
+  task->first = nullptr;
+  task->second = nullptr;
+  task->index = 0;
+  task->first_touch = 0;
+  task->tonemap = false;
+  task->feed_bands = false;
+  return task;
+}
+
+void Renderer::Submit(void (*func)(void*), RenderTask* task, px_sched::Sync* trigger){
+  auto start = std::chrono::high_resolution_clock::now();
+  px_sched::Job job = { func, task };
+  if (trigger) {
+    schd.runAfter(*trigger, job, &sync_obj);
+  } else {
+    schd.run(job, &sync_obj);
+  }
+  std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+  submit_ms_ += elapsed.count();
+  submitted_jobs_++;
+}
+
+Ray Renderer::PrimaryRay(float x, float y){
+  return PrimaryRay(x, y, target_->width, target_->height);
+}
+
+Ray Renderer::PrimaryRay(float x, float y, unsigned int width, unsigned int height){
+  float u = x / (width - 1);
+  float v = y / (height - 1);
+  Ray ray;
+  ray.origin = frame_.camera_.pos;
+  ray.dir = lower_left_corner + u * horizontal + v * vertical - frame_.camera_.pos;
+  return ray;
+}
+
+void Renderer::UpdateStep(const Tile& tile, int /*thread*/){
   MTR_SCOPE("Render", "StepUpdate");
 
-  for (int i = startrow; i < endrow; ++i) {
-    for (int j = 0; j < screen_->width; ++j) {
-      float u = float(j) / (screen_->width - 1);
-      float v = float(i) / (screen_->height - 1);
-      Ray ray;
-      ray.origin = camera_.pos;
-      ray.dir = lower_left_corner + u * horizontal + v * vertical - camera_.pos;
-
-      RayInfo info = ComputeRay(ray, num_bounces_);
+  //Sampler state lives in the task, nothing is shared between threads
+  Sampler sampler;
+  sampler.Init(frame_.sampler_type_, frame_index_, tile.y0 * target_->width + tile.x0);
+
+  for (int i = tile.y0; i < tile.y1; ++i) {
+    size_t index = (size_t)i * target_->width + tile.x0;
+    for (int j = tile.x0; j < tile.x1; ++j, ++index) {
+      //Checkerboard, the other half is kept or reconstructed afterwards
+      if (use_pixel_plan_ && pixel_plan_[index] >= kPixelReuse) continue;
+      sampler.StartPixel(j, i, frame_index_);
+      glm::vec2 jitter = PixelJitter(sampler);
+      Ray ray = PrimaryRay(j + jitter.x, i + jitter.y);
+
+      RayInfo info = ComputeRay(ray, frame_.num_bounces_, sampler);
       glm::vec3 color_;
       if (info.dist != -1.0f)
-        color_ = ComputeLighting(info);
+        color_ = ComputeLighting(info, sampler);
       else color_ = BackgroundColor(ray);
 
-      screen_->pixels[i * screen_->stride + j] = ConvertToRGBA(color_);
+      Accumulate(index, color_);
+    }
+  }
+}
 
-      
+void Renderer::TraceStep(const Tile& tile, int /*thread*/){
+  MTR_SCOPE("Render", "TraceStep");
+
+  //Only intersections, the sampler is just used for the pixel jitter
+  Sampler sampler;
+  sampler.Init(frame_.sampler_type_, frame_index_, tile.y0 * target_->width + tile.x0);
+
+  for (int i = tile.y0; i < tile.y1; ++i) {
+    size_t index = (size_t)i * gbuffer_.width + tile.x0;
+    for (int j = tile.x0; j < tile.x1; ++j, ++index) {
+      if (use_pixel_plan_ && pixel_plan_[index] >= kPixelReuse) {
+        //No hit for this pixel this frame, the reprojection and the edge
+        //mask must not use it
+        if (pixel_plan_[index] == kPixelReconstruct) gbuffer_.reconstructed[index] = 1;
+        continue;
+      }
+      sampler.StartPixel(j, i, frame_index_);
+      glm::vec2 jitter = PixelJitter(sampler);
+      Ray ray = PrimaryRay(j + jitter.x, i + jitter.y);
+      RayInfo info = ComputeRay(ray, 0, sampler);
+      gbuffer_.primary.Store(index, info);
+      gbuffer_.reconstructed[index] = 0;
+
+      //Reflection hit, same conditions as ComputeRay
+      RayInfo reflection;
+      reflection.dist = -1;
+      if (info.dist != -1 && frame_.num_bounces_ > 0 && records().material(info.geometry_index_).specular > 0.0f) {
+        Ray reflect;
+        reflect.origin = info.pos;
+        reflect.ignored_index_ = info.geometry_index_;
+        reflect.dir = glm::reflect(ray.dir, info.normal);
+        reflection = ComputeRay(reflect, 0, sampler);
+      }
+      gbuffer_.reflection.Store(index, reflection);
+    }
+  }
+}
 
+void Renderer::ShadeStep(const Tile& tile, int /*thread*/){
+  MTR_SCOPE("Render", "ShadeStep");
+
+  Sampler sampler;
+  sampler.Init(frame_.sampler_type_, frame_index_, tile.y0 * target_->width + tile.x0);
+  //Point lights shaded one by one get the shadow rays of a run of the row
+  //set up together
+  bool batched = frame_.lights_.size() <= frame_.many_lights_threshold_ &&
+    frame_.lights_.size() <= PointLightRun::kMaxLights;
+  PointLightRun run;
+
+  for (int i = tile.y0; i < tile.y1; ++i) {
+    size_t index = (size_t)i * gbuffer_.width + tile.x0;
+    for (int j = tile.x0; j < tile.x1; ++j, ++index) {
+      unsigned int pixel = (unsigned int)(j - tile.x0) % PointLightRun::kPixels;
+      if (batched && pixel == 0) {
+        unsigned int count = glm::min(PointLightRun::kPixels, (unsigned int)(tile.x1 - j));
+        SetupPointLights(gbuffer_.primary, index, count, frame_.lights_, run);
+      }
+      //Reused pixels are already in the history, reconstructed ones come later
+      if (use_pixel_plan_ && pixel_plan_[index] >= kPixelReuse) continue;
+      sampler.StartPixel(j, i, frame_index_);
+
+      RayInfo info;
+      if (!gbuffer_.primary.Load(index, info)) {
+        Accumulate(index, BackgroundColor(PrimaryRay((float)j, (float)i)));
+        continue;
+      }
+
+      const Material& material = records().material(info.geometry_index_);
+      info.color = material.color;
+      if (frame_.num_bounces_ > 0 && material.specular > 0.0f) {
+        RayInfo reflection;
+        if (gbuffer_.reflection.Load(index, reflection)) {
+          reflection.color = records().material(reflection.geometry_index_).color;
+          info.color += ComputeLighting(reflection, sampler) * material.specular;
+        } else {
+          Ray reflect;
+          reflect.dir = glm::reflect(info.pos - frame_.camera_.pos, info.normal);
+          info.color += BackgroundColor(reflect) * material.specular;
+        }
+      }
+
+      Accumulate(index, ComputeLighting(info, sampler, batched ? &run : nullptr, pixel));
     }
   }
 }
 
-float Renderer::LengthSquared(glm::vec3 v){
-  return v.x * v.x + v.y * v.y + v.z * v.z;
+void Renderer::ReconstructStep(const Tile& tile, int /*thread*/){
+  MTR_SCOPE("Render", "ReconstructStep");
+  int width = target_->width;
+  int height = target_->height;
+
+  for (int i = tile.y0; i < tile.y1; ++i) {
+    size_t index = (size_t)i * width + tile.x0;
+    for (int j = tile.x0; j < tile.x1; ++j, ++index) {
+      if (pixel_plan_[index] != kPixelReconstruct) continue;
+
+      //The four neighbours are on the traced half. Interpolate along the
+      //direction with the smallest difference so edges are not blurred.
+      glm::vec3 left = Resolve(accumulation_[index - (j > 0 ? 1 : -1)]);
+      glm::vec3 right = Resolve(accumulation_[index + (j < width - 1 ? 1 : -1)]);
+      glm::vec3 up = Resolve(accumulation_[index - (i > 0 ? width : -width)]);
+      glm::vec3 down = Resolve(accumulation_[index + (i < height - 1 ? width : -width)]);
+
+      glm::vec3 luma(0.299f, 0.587f, 0.114f);
+      float horizontal_diff = glm::abs(glm::dot(left - right, luma));
+      float vertical_diff = glm::abs(glm::dot(up - down, luma));
+
+      glm::vec3 color;
+      if (horizontal_diff < vertical_diff * 0.5f) {
+        color = (left + right) * 0.5f;
+      } else if (vertical_diff < horizontal_diff * 0.5f) {
+        color = (up + down) * 0.5f;
+      } else {
+        color = (left + right + up + down) * 0.25f;
+      }
+
+      //Weight 0, the first traced sample replaces it
+      accumulation_[index] = glm::vec4(color, 0.0f);
+    }
+  }
 }
 
-float Renderer::Rand(){
-  return rand() / (RAND_MAX + 1.0f);
+void Renderer::TonemapStep(const Tile& tile, int /*thread*/){
+  MTR_SCOPE("Render", "TonemapStep");
+  //The history holds the linear color of every pixel of the frame
+  for (int i = tile.y0; i < tile.y1; ++i) {
+    tonemapper_.ConvertRow(&accumulation_[(size_t)i * target_->width + tile.x0],
+      target_->pixels + i * target_->stride + tile.x0, tile.x1 - tile.x0, tile.x0, i);
+  }
 }
 
-float Renderer::RandRange(float min, float max){
-  return min + (max - min) * Rand();
+glm::vec2 Renderer::PixelJitter(Sampler& sampler){
+  //First sample through the pixel center so a single frame stays stable.
+  //Reprojected pixels keep adding to their history while the camera moves,
+  //so those samples move around the pixel with the frame index.
+  if (accumulated_frames_ == 0 && reused_pixels_ == 0) return glm::vec2(0.0f, 0.0f);
+  return sampler.Get2D(kPixelJitterDimension, sampler.sample_index()) - glm::vec2(0.5f, 0.5f);
 }
 
-glm::vec3 Renderer::RandVec(float lengthmin, float lengthmax){
-  return glm::vec3(RandRange(lengthmin, lengthmax), RandRange(lengthmin, lengthmax), RandRange(lengthmin, lengthmax));
+void Renderer::Accumulate(size_t index, glm::vec3 color){
+  glm::vec4& total = accumulation_[index];
+  bool add = accumulated_frames_ > 0;
+  if (use_pixel_plan_) add = pixel_plan_[index] == kPixelRefresh;
+  if (!add || total.w == 0.0f) {
+    total = glm::vec4(color, 1.0f);
+  } else {
+    total += glm::vec4(color, 1.0f);
+  }
 }
 
-glm::vec3 Renderer::RandSphere(){
-  while (true) {
-    glm::vec3 p = RandVec(-1, 1);
-    if (LengthSquared(p) >= 1) continue;
-    return p;
+void Renderer::GetLinearImage(std::vector<glm::vec3>* colors, unsigned int* width, unsigned int* height) const {
+  *width = last_width_;
+  *height = last_height_;
+  colors->resize(accumulation_.size());
+  for (size_t i = 0; i < accumulation_.size(); ++i) {
+    colors->at(i) = Resolve(accumulation_[i]);
   }
-  return glm::vec3();
+}
+
+glm::vec3 Renderer::Resolve(const glm::vec4& total){
+  //Reconstructed pixels have no samples, just the interpolated color
+  if (total.w == 0.0f) return glm::vec3(total);
+  return glm::vec3(total) / total.w;
+}
+
+float Renderer::LengthSquared(glm::vec3 v){
+  return v.x * v.x + v.y * v.y + v.z * v.z;
 }
 
 
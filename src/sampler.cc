@@ -0,0 +1,149 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#include "sampler.h"
+
+static inline float ToFloat(uint32_t x) {
+  //24 bits of mantissa, always < 1.0f
+  return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+static inline uint32_t ReverseBits(uint32_t x) {
+  x = (x << 16) | (x >> 16);
+  x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+  x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+  x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+  x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+  return x;
+}
+
+static inline uint32_t Hash(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x7feb352d;
+  x ^= x >> 15;
+  x *= 0x846ca68b;
+  x ^= x >> 16;
+  return x;
+}
+
+static inline uint32_t HashCombine(uint32_t seed, uint32_t v) {
+  return seed ^ (v + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
+
+//Owen scrambling with a hash (Burley 2020, Practical Hash-based Owen Scrambling)
+static inline uint32_t LaineKarrasPermutation(uint32_t x, uint32_t seed) {
+  x += seed;
+  x ^= x * 0x6c50b47c;
+  x ^= x * 0xb82f1e52;
+  x ^= x * 0xc7afe638;
+  x ^= x * 0x8d22f6e6;
+  return x;
+}
+
+static inline uint32_t NestedUniformScramble(uint32_t x, uint32_t seed) {
+  x = ReverseBits(x);
+  x = LaineKarrasPermutation(x, seed);
+  return ReverseBits(x);
+}
+
+//Second Sobol dimension, the first one is just ReverseBits(index)
+static inline uint32_t SobolDim1(uint32_t index) {
+  uint32_t result = 0;
+  for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1) {
+    if (index & 1) result ^= v;
+  }
+  return result;
+}
+
+//Interleaved gradient noise (Jimenez 2014), a cheap blue noise like mask that
+//avoids shipping a blue noise texture
+static inline float InterleavedGradientNoise(float x, float y) {
+  return glm::fract(52.9829189f * glm::fract(0.06711056f * x + 0.00583715f * y));
+}
+
+void Pcg32::Seed(uint64_t seed, uint64_t sequence){
+  state = 0u;
+  inc = (sequence << 1u) | 1u;
+  Next();
+  state += seed;
+  Next();
+}
+
+uint32_t Pcg32::Next(){
+  uint64_t old_state = state;
+  state = old_state * 6364136223846793005ULL + inc;
+  uint32_t xorshifted = (uint32_t)(((old_state >> 18u) ^ old_state) >> 27u);
+  uint32_t rot = (uint32_t)(old_state >> 59u);
+  return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31));
+}
+
+float Pcg32::NextFloat(){
+  return ToFloat(Next());
+}
+
+Sampler::Sampler(){
+  type_ = kSamplerSobol;
+  pixel_seed_ = 0;
+  pixel_x_ = 0;
+  pixel_y_ = 0;
+  sample_index_ = 0;
+  dimension_ = 0;
+}
+
+void Sampler::Init(SamplerType type, uint64_t seed, uint64_t stream){
+  type_ = type;
+  rng_.Seed(seed, stream);
+}
+
+void Sampler::StartPixel(unsigned int x, unsigned int y, unsigned int sample_index){
+  pixel_x_ = x;
+  pixel_y_ = y;
+  pixel_seed_ = Hash(HashCombine(Hash(x), y));
+  sample_index_ = sample_index;
+  dimension_ = 0;
+}
+
+glm::vec2 Sampler::Get2D(unsigned int dimension, unsigned int index){
+  switch (type_) {
+  case kSamplerSobol: {
+    uint32_t seed = Hash(HashCombine(pixel_seed_, dimension));
+    //Shuffling the index decorrelates the dimension pairs (padding)
+    uint32_t i = NestedUniformScramble(index, seed);
+    uint32_t x = NestedUniformScramble(ReverseBits(i), HashCombine(seed, 0));
+    uint32_t y = NestedUniformScramble(SobolDim1(i), HashCombine(seed, 1));
+    return glm::vec2(ToFloat(x), ToFloat(y));
+  }
+  case kSamplerBlueNoise: {
+    //Mask offset per dimension so every pair sees a different pattern, the
+    //R2 sequence spreads the samples of the same pixel
+    float offset = 5.588238f * dimension;
+    float mask_x = InterleavedGradientNoise(pixel_x_ + offset, pixel_y_ + offset);
+    float mask_y = InterleavedGradientNoise(pixel_x_ + offset + 31.0f, pixel_y_ + offset + 17.0f);
+    return glm::vec2(glm::fract(mask_x + 0.7548776662f * index),
+      glm::fract(mask_y + 0.5698402910f * index));
+  }
+  default:
+    return glm::vec2(rng_.NextFloat(), rng_.NextFloat());
+  }
+}
+
+glm::vec2 ConcentricDisk(glm::vec2 u){
+  glm::vec2 offset = 2.0f * u - glm::vec2(1.0f, 1.0f);
+  if (offset.x == 0.0f && offset.y == 0.0f) return glm::vec2(0.0f, 0.0f);
+
+  float r, theta;
+  if (glm::abs(offset.x) > glm::abs(offset.y)) {
+    r = offset.x;
+    theta = 0.78539816f * (offset.y / offset.x);
+  } else {
+    r = offset.y;
+    theta = 1.57079633f - 0.78539816f * (offset.x / offset.y);
+  }
+  return r * glm::vec2(glm::cos(theta), glm::sin(theta));
+}
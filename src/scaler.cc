@@ -0,0 +1,178 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#include "scaler.h"
+#include "renderer.h"
+
+#if defined(_M_X64) || defined(_M_IX86_FP) || defined(__SSE2__)
+#define SCALER_SSE2 1
+#include <emmintrin.h>
+#endif
+//Only when the compiler targets it, see --avx2 in premake4.lua
+#if defined(__AVX2__)
+#define SCALER_AVX2 1
+#include <immintrin.h>
+#endif
+
+//Fills the source index, next index and weight for every output pixel on
+//one axis, pixel centers aligned
+static void SetupAxis(unsigned int src, unsigned int dst, std::vector<unsigned int>& index,
+  std::vector<unsigned int>& next, std::vector<unsigned int>& weight) {
+
+  index.resize(dst);
+  next.resize(dst);
+  weight.resize(dst);
+
+  long long step = ((long long)src << 16) / dst;
+  long long pos = step / 2 - (1 << 15);
+  long long last = (long long)(src - 1) << 16;
+  for (unsigned int i = 0; i < dst; ++i, pos += step) {
+    long long clamped = pos < 0 ? 0 : (pos > last ? last : pos);
+    index[i] = (unsigned int)(clamped >> 16);
+    next[i] = index[i] + 1 < src ? index[i] + 1 : src - 1;
+    weight[i] = (unsigned int)((clamped & 0xffff) >> (16 - Scaler::kWeightBits));
+  }
+}
+
+void Scaler::Setup(unsigned int src_width, unsigned int src_height,
+  unsigned int dst_width, unsigned int dst_height){
+
+  if (src_width == src_width_ && src_height == src_height_ &&
+    dst_width == dst_width_ && dst_height == dst_height_) {
+    return;
+  }
+  src_width_ = src_width;
+  src_height_ = src_height;
+  dst_width_ = dst_width;
+  dst_height_ = dst_height;
+
+  std::vector<unsigned int> weight;
+  SetupAxis(src_width, dst_width, column_, column_next_, weight);
+  column_weight_.resize(dst_width);
+  for (unsigned int x = 0; x < dst_width; ++x) {
+    column_weight_[x] = weight[x] * 0x0001000100010001ULL;
+  }
+  SetupAxis(src_height, dst_height, row_, row_next_, row_weight_);
+}
+
+static inline unsigned int LerpARGB(unsigned int a, unsigned int b, unsigned int t) {
+  unsigned int out = 0;
+  for (int shift = 0; shift < 32; shift += 8) {
+    int ca = (a >> shift) & 0xff;
+    int cb = (b >> shift) & 0xff;
+    int c = ca + (((cb - ca) * (int)t + (1 << (Scaler::kWeightBits - 1))) >> Scaler::kWeightBits);
+    out |= (unsigned int)c << shift;
+  }
+  return out;
+}
+
+#ifdef SCALER_SSE2
+//a + (b - a) * t per 16 bit lane, t in [0, 1 << kWeightBits]
+static inline __m128i Lerp16(__m128i a, __m128i b, __m128i t) {
+  const __m128i round = _mm_set1_epi16(1 << (Scaler::kWeightBits - 1));
+  __m128i d = _mm_mullo_epi16(_mm_sub_epi16(b, a), t);
+  return _mm_add_epi16(a, _mm_srai_epi16(_mm_add_epi16(d, round), Scaler::kWeightBits));
+}
+#endif
+
+#ifdef SCALER_AVX2
+static inline __m256i Lerp16(__m256i a, __m256i b, __m256i t) {
+  const __m256i round = _mm256_set1_epi16(1 << (Scaler::kWeightBits - 1));
+  __m256i d = _mm256_mullo_epi16(_mm256_sub_epi16(b, a), t);
+  return _mm256_add_epi16(a, _mm256_srai_epi16(_mm256_add_epi16(d, round), Scaler::kWeightBits));
+}
+#endif
+
+void Scaler::ScaleRows(const TScreen& src, TScreen& dst, unsigned int startrow, unsigned int endrow,
+  unsigned int* scratch) const {
+  //Source rows blended vertically once, then sampled horizontally
+  unsigned int* blended = scratch;
+  //Locals, the SIMD stores may alias anything and would force reloads
+  const unsigned int* column = &column_[0];
+  const unsigned int* column_next = &column_next_[0];
+  const unsigned long long* column_weight = &column_weight_[0];
+  unsigned int width = dst_width_;
+  //Only the source columns an output row reads
+  unsigned int first = column[0];
+  unsigned int last = column_next[width - 1] + 1;
+
+  for (unsigned int y = startrow; y < endrow; ++y) {
+    const unsigned int* line0 = src.pixels + row_[y] * src.stride;
+    const unsigned int* line1 = src.pixels + row_next_[y] * src.stride;
+    unsigned int fy = row_weight_[y];
+    unsigned int* out_line = dst.pixels + y * dst.stride;
+
+    const unsigned int* line = line0;
+    if (fy != 0) {
+      unsigned int x = first;
+#ifdef SCALER_AVX2
+      //Same math as the SSE2 loop, 8 pixels at a time. The unpacks and the
+      //pack work inside each 128 bit lane, so the order comes out right.
+      const __m256i zero8 = _mm256_setzero_si256();
+      const __m256i t8 = _mm256_set1_epi16((short)fy);
+      for (; x + 8 <= last; x += 8) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(line0 + x));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(line1 + x));
+        __m256i lo = Lerp16(_mm256_unpacklo_epi8(a, zero8), _mm256_unpacklo_epi8(b, zero8), t8);
+        __m256i hi = Lerp16(_mm256_unpackhi_epi8(a, zero8), _mm256_unpackhi_epi8(b, zero8), t8);
+        _mm256_storeu_si256((__m256i*)(blended + x), _mm256_packus_epi16(lo, hi));
+      }
+#endif
+#ifdef SCALER_SSE2
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i t = _mm_set1_epi16((short)fy);
+      for (; x + 4 <= last; x += 4) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(line0 + x));
+        __m128i b = _mm_loadu_si128((const __m128i*)(line1 + x));
+        __m128i lo = Lerp16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), t);
+        __m128i hi = Lerp16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), t);
+        _mm_storeu_si128((__m128i*)(blended + x), _mm_packus_epi16(lo, hi));
+      }
+#endif
+      for (; x < last; ++x) {
+        blended[x] = LerpARGB(line0[x], line1[x], fy);
+      }
+      line = blended;
+    }
+
+    unsigned int x = 0;
+#ifdef SCALER_AVX2
+    const __m256i zero8 = _mm256_setzero_si256();
+    for (; x + 8 <= width; x += 8) {
+      __m256i a = _mm256_i32gather_epi32((const int*)line, _mm256_loadu_si256((const __m256i*)(column + x)), 4);
+      __m256i b = _mm256_i32gather_epi32((const int*)line, _mm256_loadu_si256((const __m256i*)(column_next + x)), 4);
+      //The low halves of the lanes are pixels 0 1 4 5, the high ones 2 3 6 7
+      __m256i w0 = _mm256_loadu_si256((const __m256i*)(column_weight + x));
+      __m256i w1 = _mm256_loadu_si256((const __m256i*)(column_weight + x + 4));
+      __m256i t = _mm256_permute2x128_si256(w0, w1, 0x20);
+      __m256i t2 = _mm256_permute2x128_si256(w0, w1, 0x31);
+      __m256i lo = Lerp16(_mm256_unpacklo_epi8(a, zero8), _mm256_unpacklo_epi8(b, zero8), t);
+      __m256i hi = Lerp16(_mm256_unpackhi_epi8(a, zero8), _mm256_unpackhi_epi8(b, zero8), t2);
+      _mm256_storeu_si256((__m256i*)(out_line + x), _mm256_packus_epi16(lo, hi));
+    }
+#endif
+#ifdef SCALER_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 4 <= width; x += 4) {
+      __m128i a = _mm_setr_epi32(line[column[x]], line[column[x + 1]],
+        line[column[x + 2]], line[column[x + 3]]);
+      __m128i b = _mm_setr_epi32(line[column_next[x]], line[column_next[x + 1]],
+        line[column_next[x + 2]], line[column_next[x + 3]]);
+      __m128i t = _mm_loadu_si128((const __m128i*)(column_weight + x));
+      __m128i t2 = _mm_loadu_si128((const __m128i*)(column_weight + x + 2));
+      __m128i lo = Lerp16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), t);
+      __m128i hi = Lerp16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), t2);
+      _mm_storeu_si128((__m128i*)(out_line + x), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; x < width; ++x) {
+      out_line[x] = LerpARGB(line[column[x]], line[column_next[x]], (unsigned int)(column_weight[x] & 0xffff));
+    }
+  }
+}
@@ -0,0 +1,100 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#include "scene.h"
+
+#include <string>
+
+void PrepareDemoScene(DemoScene* scene, Renderer* renderer, const char* data_path){
+  std::string data = data_path;
+
+  renderer->camera_.pos = {0.0f,0.0f,0.0f};
+  renderer->camera_.focal_length = 1.0f;
+  renderer->camera_.u = 1.77f;
+  renderer->camera_.v = 1.0f;
+
+  renderer->light_offset_ = 0.01f;
+  renderer->light_samples_ = 8;
+  renderer->light_probe_samples_ = 2;
+
+  scene->sphere1_.pos_ = glm::vec3(0.0f, 0.0f, -20.0f);
+  scene->sphere1_.color_ = glm::vec3(1.0f,0.32f,0.36f);
+  scene->sphere1_.radius_ = 4.0f;
+  scene->sphere1_.diffuse_ = 0.0f;
+  scene->sphere1_.specular_ = 1.0f;
+  scene->sphere1_.InitAABB();
+
+  scene->sphere2_.pos_ = glm::vec3(5.0f, -1.0f, -15.0f);
+  scene->sphere2_.color_ = glm::vec3(0.9f, 0.76f, 0.46f);
+  scene->sphere2_.radius_ = 2.0f;
+  scene->sphere2_.diffuse_ = 0.0f;
+  scene->sphere2_.specular_ = 1.0f;
+  scene->sphere2_.InitAABB();
+
+  scene->sphere3_.pos_ = glm::vec3(5.0f, 0.0f, -25.0f);
+  scene->sphere3_.color_ = glm::vec3(0.65f, 0.77f, 0.97f);
+  scene->sphere3_.radius_ = 3.0f;
+  scene->sphere3_.diffuse_ = 0.0f;
+  scene->sphere3_.specular_ = 1.0f;
+  scene->sphere3_.InitAABB();
+
+  scene->sphere4_.pos_ = glm::vec3(-5.5f,0.0f,-15.0f);
+  scene->sphere4_.color_ = glm::vec3(0.90f, 0.90f, 0.90f);
+  scene->sphere4_.radius_ = 3.0f;
+  scene->sphere4_.diffuse_ = 1.0f;
+  scene->sphere4_.specular_ = 0.0f;
+  scene->sphere4_.InitAABB();
+
+  scene->floor_.pos_ = glm::vec3(0.0f, -10.0f, 0.0f);
+  scene->floor_.color_ = glm::vec3(1.0f, 0.0f, 0.0f);
+  scene->floor_.diffuse_ = 1.0f;
+  scene->floor_.specular_ = 1.0f;
+
+  scene->cube_.pos_ = { 3.0f,0.0f,-5.0f };
+  scene->cube_.color_ = { 1.0f,1.0f,0.0f };
+  scene->cube_.diffuse_ = 0.0f;
+  scene->cube_.specular_ = 1.0f;
+  scene->cube_.LoadObj((data + "/cube.obj").c_str());
+
+  scene->cube2_.pos_ = { -5.0f,0.0f,-10.0f };
+  scene->cube2_.color_ = { 0.0f,1.0f,0.0f };
+  scene->cube2_.diffuse_ = 1.0f;
+  scene->cube2_.specular_ = 1.0f;
+  scene->cube2_.LoadObj((data + "/cube.obj").c_str());
+
+  scene->teapot_.pos_ = { 2.0f,1.0f,-20.0f };
+  scene->teapot_.color_ = { 0.6f,0.2f,0.4f };
+  scene->teapot_.diffuse_ = 1.0f;
+  scene->teapot_.specular_ = 0.0f;
+  scene->teapot_.LoadObj((data + "/teapot.obj").c_str());
+
+  UseDemoScene(scene, renderer, kSceneBase);
+
+  scene->light1_.pos = glm::vec3(1.0f, -1.0f, -4.0f);
+  scene->light1_.intensity = 10.0f;
+  scene->light1_.color = { 0.5f,0.0f,0.0f };
+
+  renderer->lights_.push_back(scene->light1_);
+}
+
+void UseDemoScene(DemoScene* scene, Renderer* renderer, DemoSceneId id){
+  renderer->geometries.clear();
+  if (id == kSceneObjs) {
+    renderer->geometries.push_back(&scene->cube_);
+    renderer->geometries.push_back(&scene->cube2_);
+    renderer->geometries.push_back(&scene->teapot_);
+    renderer->geometries.push_back(&scene->floor_);
+    return;
+  }
+  renderer->geometries.push_back(&scene->sphere1_);
+  renderer->geometries.push_back(&scene->sphere2_);
+  renderer->geometries.push_back(&scene->sphere3_);
+  renderer->geometries.push_back(&scene->sphere4_);
+  renderer->geometries.push_back(&scene->floor_);
+}
@@ -0,0 +1,311 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#include "scene_file.h"
+#include "glm/gtx/transform.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+
+//Cursor over the whole file, which ends in a 0
+struct SceneParser {
+  const char* cursor;
+  const char* path;
+  unsigned int line;
+  bool failed;
+};
+
+struct FileMaterial {
+  glm::vec3 color;
+  float diffuse;
+  float specular;
+};
+
+struct MeshInstance {
+  unsigned int file;
+  unsigned int material;
+  glm::vec3 pos;
+  glm::mat3 transform;
+};
+
+//Objects in file order
+struct SceneObject {
+  GeometryType type;
+  unsigned int index;
+};
+
+static bool Fail(SceneParser& parser, const char* message, const char* detail = "") {
+  if (!parser.failed) printf("%s:%u: %s%s\n", parser.path, parser.line, message, detail);
+  parser.failed = true;
+  return false;
+}
+
+static void SkipSpace(SceneParser& parser) {
+  while (*parser.cursor == ' ' || *parser.cursor == '\t' || *parser.cursor == '\r') parser.cursor++;
+}
+
+static bool AtLineEnd(SceneParser& parser) {
+  SkipSpace(parser);
+  return *parser.cursor == '\n' || *parser.cursor == '#' || *parser.cursor == '\0';
+}
+
+static void NextLine(SceneParser& parser) {
+  while (*parser.cursor != '\n' && *parser.cursor != '\0') parser.cursor++;
+  if (*parser.cursor == '\n') {
+    parser.cursor++;
+    parser.line++;
+  }
+}
+
+//Up to the next space, not null terminated
+static bool ReadWord(SceneParser& parser, const char** word, size_t* length) {
+  if (AtLineEnd(parser)) return Fail(parser, "line ends too soon");
+  const char* start = parser.cursor;
+  while (*parser.cursor > ' ' && *parser.cursor != '#') parser.cursor++;
+  *word = start;
+  *length = parser.cursor - start;
+  return true;
+}
+
+static bool WordIs(const char* word, size_t length, const char* keyword) {
+  return strlen(keyword) == length && !memcmp(word, keyword, length);
+}
+
+static bool ReadFloat(SceneParser& parser, float* value) {
+  SkipSpace(parser);
+  char* end;
+  *value = strtof(parser.cursor, &end);
+  if (end == parser.cursor) return Fail(parser, "expected a number");
+  parser.cursor = end;
+  return true;
+}
+
+static bool NextIsNumber(SceneParser& parser) {
+  SkipSpace(parser);
+  char c = *parser.cursor;
+  return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.';
+}
+
+static bool ReadVec3(SceneParser& parser, glm::vec3* value) {
+  return ReadFloat(parser, &value->x) && ReadFloat(parser, &value->y) && ReadFloat(parser, &value->z);
+}
+
+static bool ReadMaterial(SceneParser& parser, const std::unordered_map<std::string, unsigned int>& names,
+  unsigned int* material) {
+  const char* word;
+  size_t length;
+  if (!ReadWord(parser, &word, &length)) return false;
+  auto found = names.find(std::string(word, length));
+  if (found == names.end()) return Fail(parser, "unknown material ", std::string(word, length).c_str());
+  *material = found->second;
+  return true;
+}
+
+//[rotate <x y z>] [scale <s> | <x y z>] after the position of a mesh
+static bool ReadTransform(SceneParser& parser, glm::mat3* transform) {
+  glm::vec3 rotation(0.0f);
+  glm::vec3 scale(1.0f);
+  while (!AtLineEnd(parser)) {
+    const char* word;
+    size_t length;
+    ReadWord(parser, &word, &length);
+    if (WordIs(word, length, "rotate")) {
+      if (!ReadVec3(parser, &rotation)) return false;
+    } else if (WordIs(word, length, "scale")) {
+      if (!ReadFloat(parser, &scale.x)) return false;
+      scale.y = scale.z = scale.x;
+      //One number scales every axis alike
+      if (NextIsNumber(parser) && !(ReadFloat(parser, &scale.y) && ReadFloat(parser, &scale.z))) return false;
+    } else {
+      return Fail(parser, "unknown mesh option ", std::string(word, length).c_str());
+    }
+  }
+  //Scaled, then turned around x, y and z
+  rotation = glm::radians(rotation);
+  glm::mat4 turn = glm::rotate(rotation.z, glm::vec3(0.0f, 0.0f, 1.0f)) *
+    glm::rotate(rotation.y, glm::vec3(0.0f, 1.0f, 0.0f)) *
+    glm::rotate(rotation.x, glm::vec3(1.0f, 0.0f, 0.0f));
+  *transform = glm::mat3(turn) * glm::mat3(glm::scale(scale));
+  return true;
+}
+
+//Runs body(i) for i in [0, count) on every logical processor
+template <typename Body>
+static void ParallelFor(unsigned int count, const Body& body) {
+  unsigned int threads = std::min(count, std::max(1u, std::thread::hardware_concurrency()));
+  std::atomic<unsigned int> next(0);
+  auto work = [&]() {
+    for (unsigned int i = next++; i < count; i = next++) body(i);
+  };
+  std::vector<std::thread> pool;
+  for (unsigned int i = 1; i < threads; ++i) pool.emplace_back(work);
+  work();
+  for (std::thread& thread : pool) thread.join();
+}
+
+static bool ReadFile(const char* path, std::vector<char>* text) {
+  FILE* file = fopen(path, "rb");
+  if (!file) return false;
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  text->resize(size > 0 ? size + 1 : 1);
+  size_t read = size > 0 ? fread(text->data(), 1, size, file) : 0;
+  fclose(file);
+  (*text)[read] = '\0';
+  return size >= 0 && read == (size_t)size;
+}
+
+bool LoadSceneFile(const char* path, SceneFile* scene, Renderer* renderer){
+  std::vector<char> text;
+  if (!ReadFile(path, &text)) {
+    printf("Can't read %s\n", path);
+    return false;
+  }
+  std::string folder = path;
+  size_t slash = folder.find_last_of("/\\");
+  folder = slash == std::string::npos ? std::string() : folder.substr(0, slash + 1);
+
+  SceneParser parser = { text.data(), path, 1, false };
+  std::vector<FileMaterial> materials;
+  std::unordered_map<std::string, unsigned int> material_names;
+  std::vector<std::string> mesh_files;
+  std::unordered_map<std::string, unsigned int> mesh_file_names;
+  std::vector<MeshInstance> instances;
+  std::vector<SceneObject> objects;
+  std::vector<Light> lights;
+  //Nothing the renderer points to changes until the whole file is loaded
+  SceneFile loaded;
+
+  Camera camera = renderer->camera_;
+  bool has_sun = false;
+  glm::vec3 sun;
+  for (; *parser.cursor != '\0' && !parser.failed; NextLine(parser)) {
+    if (AtLineEnd(parser)) continue;
+    const char* word;
+    size_t length;
+    ReadWord(parser, &word, &length);
+
+    if (WordIs(word, length, "camera")) {
+      //Without u the aspect of the current camera is kept
+      float aspect = camera.u / camera.v;
+      if (ReadVec3(parser, &camera.pos) && ReadFloat(parser, &camera.focal_length) && ReadFloat(parser, &camera.v)) {
+        camera.u = camera.v * aspect;
+        if (NextIsNumber(parser)) ReadFloat(parser, &camera.u);
+      }
+    } else if (WordIs(word, length, "sun")) {
+      has_sun = ReadVec3(parser, &sun);
+    } else if (WordIs(word, length, "light")) {
+      Light light;
+      if (ReadVec3(parser, &light.pos) && ReadVec3(parser, &light.color) && ReadFloat(parser, &light.intensity)) {
+        lights.push_back(light);
+      }
+    } else if (WordIs(word, length, "material")) {
+      const char* name;
+      size_t name_length;
+      FileMaterial material;
+      if (ReadWord(parser, &name, &name_length) && ReadVec3(parser, &material.color) &&
+        ReadFloat(parser, &material.diffuse) && ReadFloat(parser, &material.specular)) {
+        //A later definition replaces the earlier one for the objects after it
+        material_names[std::string(name, name_length)] = (unsigned int)materials.size();
+        materials.push_back(material);
+      }
+    } else if (WordIs(word, length, "sphere")) {
+      Sphere sphere;
+      unsigned int material;
+      if (ReadMaterial(parser, material_names, &material) && ReadVec3(parser, &sphere.pos_) &&
+        ReadFloat(parser, &sphere.radius_)) {
+        sphere.color_ = materials[material].color;
+        sphere.diffuse_ = materials[material].diffuse;
+        sphere.specular_ = materials[material].specular;
+        sphere.InitAABB();
+        objects.push_back({ kGeometrySphere, (unsigned int)loaded.spheres_.size() });
+        loaded.spheres_.push_back(sphere);
+      }
+    } else if (WordIs(word, length, "plane")) {
+      Plane plane;
+      unsigned int material;
+      if (ReadMaterial(parser, material_names, &material) && ReadVec3(parser, &plane.pos_) &&
+        ReadVec3(parser, &plane.normal_)) {
+        plane.normal_ = glm::normalize(plane.normal_);
+        plane.color_ = materials[material].color;
+        plane.diffuse_ = materials[material].diffuse;
+        plane.specular_ = materials[material].specular;
+        objects.push_back({ kGeometryPlane, (unsigned int)loaded.planes_.size() });
+        loaded.planes_.push_back(plane);
+      }
+    } else if (WordIs(word, length, "mesh")) {
+      MeshInstance instance;
+      const char* file;
+      size_t file_length;
+      if (ReadMaterial(parser, material_names, &instance.material) && ReadWord(parser, &file, &file_length) &&
+        ReadVec3(parser, &instance.pos) && ReadTransform(parser, &instance.transform)) {
+        std::string file_path = folder + std::string(file, file_length);
+        auto found = mesh_file_names.find(file_path);
+        if (found == mesh_file_names.end()) {
+          found = mesh_file_names.insert(std::make_pair(file_path, (unsigned int)mesh_files.size())).first;
+          mesh_files.push_back(file_path);
+        }
+        instance.file = found->second;
+        objects.push_back({ kGeometryMesh, (unsigned int)instances.size() });
+        instances.push_back(instance);
+      }
+    } else {
+      Fail(parser, "unknown keyword ", std::string(word, length).c_str());
+    }
+    if (!parser.failed && !AtLineEnd(parser)) Fail(parser, "unexpected text at the end of the line");
+  }
+  if (parser.failed) return false;
+
+  //Every obj once, then the meshes copy them
+  std::vector<CustomGeometry> files(mesh_files.size());
+  ParallelFor((unsigned int)files.size(), [&](unsigned int i) {
+    files[i].LoadObj(mesh_files[i].c_str());
+  });
+  for (size_t i = 0; i < files.size(); ++i) {
+    if (files[i].vertices_.empty()) {
+      printf("%s: can't load %s\n", path, mesh_files[i].c_str());
+      return false;
+    }
+  }
+  loaded.meshes_.resize(instances.size());
+  ParallelFor((unsigned int)instances.size(), [&](unsigned int i) {
+    const MeshInstance& instance = instances[i];
+    CustomGeometry& mesh = loaded.meshes_[i];
+    mesh.pos_ = instance.pos;
+    mesh.color_ = materials[instance.material].color;
+    mesh.diffuse_ = materials[instance.material].diffuse;
+    mesh.specular_ = materials[instance.material].specular;
+    mesh.Instance(files[instance.file], instance.transform);
+  });
+  loaded.mesh_files_ = (unsigned int)files.size();
+
+  //The old objects go away here, the renderer points to the new ones
+  *scene = std::move(loaded);
+  renderer->camera_ = camera;
+  if (has_sun) renderer->SetLightRotation(sun.x, sun.y, sun.z);
+  renderer->lights_ = lights;
+  renderer->geometries.clear();
+  renderer->geometries.reserve(objects.size());
+  for (const SceneObject& object : objects) {
+    switch (object.type) {
+    case kGeometrySphere: renderer->geometries.push_back(&scene->spheres_[object.index]); break;
+    case kGeometryPlane: renderer->geometries.push_back(&scene->planes_[object.index]); break;
+    case kGeometryMesh: renderer->geometries.push_back(&scene->meshes_[object.index]); break;
+    }
+  }
+  //A reloaded scene can reuse the addresses of the last one
+  renderer->MarkGeometryDirty();
+  return true;
+}
@@ -0,0 +1,137 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#include "tonemap.h"
+
+#include <math.h>
+
+#if defined(_M_X64) || defined(_M_IX86_FP) || defined(__SSE2__)
+#define TONEMAP_SSE2 1
+#include <emmintrin.h>
+#endif
+
+//4x4 ordered dither, in 1/16ths of a level
+static const unsigned char kBayer[4][4] = {
+  { 0, 8, 2, 10 },
+  { 12, 4, 14, 6 },
+  { 3, 11, 1, 9 },
+  { 15, 7, 13, 5 },
+};
+
+//Brightest linear value fed to a curve, keeps them away from inf / inf
+static const float kMaxRadiance = 65504.0f;
+
+Tonemapper::Tonemapper(){
+  int size = 1 << kLutBits;
+  for (int i = 0; i < size; ++i) {
+    float linear = (float)i / (size - 1);
+    float encoded = linear <= 0.0031308f ? linear * 12.92f : 1.055f * powf(linear, 1.0f / 2.4f) - 0.055f;
+    srgb_lut_[i] = (unsigned short)(encoded * 255.0f * 16.0f + 0.5f);
+  }
+  Setup(kToneClamp, 1.0f, false, false);
+}
+
+void Tonemapper::Setup(ToneCurve curve, float exposure, bool srgb, bool dither){
+  curve_ = curve;
+  exposure_ = exposure;
+  srgb_ = srgb;
+  dither_ = dither;
+}
+
+static inline float Curve(float v, ToneCurve curve) {
+  v = v > 0.0f ? (v < kMaxRadiance ? v : kMaxRadiance) : 0.0f;
+  switch (curve) {
+  case kToneReinhard:
+    return v / (1.0f + v);
+  case kToneFilmic:
+    return (v * (2.51f * v + 0.03f)) / (v * (2.43f * v + 0.59f) + 0.14f);
+  default:
+    return v;
+  }
+}
+
+unsigned int Tonemapper::ConvertPixel(const glm::vec3& color, unsigned int x, unsigned int y) const {
+  unsigned int dither = dither_ ? kBayer[y & 3][x & 3] : (srgb_ ? 8 : 0);
+  unsigned int out = 0;
+  for (int i = 0; i < 3; ++i) {
+    float v = Curve(color[i] * exposure_, curve_);
+    if (v > 1.0f) v = 1.0f;
+    unsigned int level;
+    if (srgb_) {
+      level = (srgb_lut_[(int)(v * ((1 << kLutBits) - 1) + 0.5f)] + dither) >> 4;
+    } else {
+      level = (unsigned int)(v * 255.0f + dither * (1.0f / 16.0f));
+    }
+    out |= level << (16 - 8 * i);
+  }
+  return out;
+}
+
+#ifdef TONEMAP_SSE2
+static inline __m128 Curve(__m128 v, ToneCurve curve) {
+  v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(kMaxRadiance));
+  switch (curve) {
+  case kToneReinhard:
+    return _mm_div_ps(v, _mm_add_ps(_mm_set1_ps(1.0f), v));
+  case kToneFilmic: {
+    __m128 num = _mm_mul_ps(v, _mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(2.51f)), _mm_set1_ps(0.03f)));
+    __m128 den = _mm_add_ps(_mm_mul_ps(v, _mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(2.43f)), _mm_set1_ps(0.59f))),
+      _mm_set1_ps(0.14f));
+    return _mm_div_ps(num, den);
+  }
+  default:
+    return v;
+  }
+}
+#endif
+
+void Tonemapper::ConvertRow(const glm::vec4* colors, unsigned int* out, unsigned int count,
+  unsigned int x, unsigned int y) const {
+  const unsigned char* bayer = kBayer[y & 3];
+  unsigned int i = 0;
+#ifdef TONEMAP_SSE2
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 exposure = _mm_set1_ps(exposure_);
+  const __m128 rgb = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+  const __m128 levels = _mm_set1_ps(srgb_ ? (float)((1 << kLutBits) - 1) : 255.0f);
+  for (; i + 4 <= count; i += 4) {
+    __m128i pixel[4];
+    for (int p = 0; p < 4; ++p) {
+      //Lanes as b, g, r, a so the packed bytes are ARGB in memory
+      __m128 c = _mm_loadu_ps(&colors[i + p].x);
+      c = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 1, 2));
+      __m128 w = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 3, 3));
+      __m128 single = _mm_cmpeq_ps(w, zero);
+      w = _mm_or_ps(_mm_and_ps(single, one), _mm_andnot_ps(single, w));
+      c = _mm_and_ps(_mm_div_ps(c, w), rgb);
+      c = _mm_min_ps(Curve(_mm_mul_ps(c, exposure), curve_), one);
+
+      unsigned int dither = dither_ ? bayer[(x + i + p) & 3] : (srgb_ ? 8 : 0);
+      if (srgb_) {
+        //Table indices fit in 16 bits, b, g and r are in the even words
+        __m128i index = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, levels), _mm_set1_ps(0.5f)));
+        pixel[p] = _mm_setr_epi32((srgb_lut_[_mm_extract_epi16(index, 0)] + dither) >> 4,
+          (srgb_lut_[_mm_extract_epi16(index, 2)] + dither) >> 4,
+          (srgb_lut_[_mm_extract_epi16(index, 4)] + dither) >> 4, 0);
+      } else {
+        pixel[p] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, levels), _mm_set1_ps(dither * (1.0f / 16.0f))));
+      }
+    }
+    __m128i low = _mm_packs_epi32(pixel[0], pixel[1]);
+    __m128i high = _mm_packs_epi32(pixel[2], pixel[3]);
+    _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(low, high));
+  }
+#endif
+  for (; i < count; ++i) {
+    const glm::vec4& total = colors[i];
+    glm::vec3 color = total.w == 0.0f ? glm::vec3(total) : glm::vec3(total) / total.w;
+    out[i] = ConvertPixel(color, x + i, y);
+  }
+}
@@ -0,0 +1,93 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#include "topology.h"
+
+#include <stdio.h>
+#include <thread>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+static thread_local int t_thread_node = -1;
+
+CpuTopology DetectTopology(){
+  CpuTopology topology;
+  unsigned int count = std::thread::hardware_concurrency();
+  topology.logical_processors = count > 0 ? count : 1;
+  topology.processor_node.assign(topology.logical_processors, 0);
+
+#ifdef _WIN32
+  //Only the first processor group, up to 64 logical processors
+  for (unsigned int i = 0; i < topology.logical_processors && i < 64; ++i) {
+    UCHAR node = 0;
+    if (GetNumaProcessorNode((UCHAR)i, &node) && node != 0xff) {
+      topology.processor_node[i] = node;
+    }
+  }
+#else
+  //Each node lists its processors as ranges, "0-7,16-23"
+  for (unsigned int node = 0; node < 64; ++node) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+    FILE* file = fopen(path, "r");
+    if (!file) continue;
+    unsigned int first, last;
+    int read;
+    while ((read = fscanf(file, "%u-%u", &first, &last)) >= 1) {
+      if (read == 1) last = first;
+      for (unsigned int i = first; i <= last && i < topology.logical_processors; ++i) {
+        topology.processor_node[i] = node;
+      }
+      if (fgetc(file) != ',') break;
+    }
+    fclose(file);
+  }
+#endif
+
+  for (unsigned int i = 0; i < topology.logical_processors; ++i) {
+    if (topology.processor_node[i] + 1 > topology.numa_nodes)
+      topology.numa_nodes = topology.processor_node[i] + 1;
+  }
+  return topology;
+}
+
+void PrintTopology(const CpuTopology& topology){
+  printf("%u logical processors, %u NUMA node(s)\n", topology.logical_processors, topology.numa_nodes);
+  for (unsigned int node = 0; node < topology.numa_nodes; ++node) {
+    unsigned int processors = 0;
+    for (unsigned int i = 0; i < topology.logical_processors; ++i) {
+      if (topology.processor_node[i] == node) processors++;
+    }
+    printf("  node %u: %u logical processors\n", node, processors);
+  }
+}
+
+bool PinCurrentThread(unsigned int processor, unsigned int node){
+  bool pinned;
+#ifdef _WIN32
+  pinned = processor < 64 &&
+    SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << processor) != 0;
+#else
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(processor, &set);
+  pinned = pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#endif
+  t_thread_node = pinned ? (int)node : -1;
+  return pinned;
+}
+
+int CurrentThreadNode(){
+  return t_thread_node;
+}
@@ -0,0 +1,252 @@
+/*---------------------------------------------------------------------
+Copyright (c) 2020 Pablo Bengoa (bengoana)
+https://github.com/bengoana
+
+This software is released under the MIT license.
+
+This program is a college project uploaded for showcase purposes.
+---------------------------------------------------------------------*/
+
+#include "video_stream.h"
+#include "renderer.h"
+
+#include <chrono>
+#include <string.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#define dup _dup
+#define dup2 _dup2
+#define fdopen _fdopen
+#else
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86_FP) || defined(__SSE2__)
+#define VIDEO_SSE2 1
+#include <emmintrin.h>
+#endif
+
+//BT.601 studio range in 8 bit fixed point, the pixels are BGRA in memory
+static inline unsigned char LumaBT601(unsigned int b, unsigned int g, unsigned int r) {
+  return (unsigned char)(((66 * (int)r + 129 * (int)g + 25 * (int)b + 128) >> 8) + 16);
+}
+
+//b, g and r are the sums of a 2x2 block
+static inline void ChromaBT601(int b, int g, int r, unsigned char* u, unsigned char* v) {
+  *u = (unsigned char)(((-38 * r - 74 * g + 112 * b + 512) >> 10) + 128);
+  *v = (unsigned char)(((112 * r - 94 * g - 18 * b + 512) >> 10) + 128);
+}
+
+static void ConvertRowsRGB24(const TScreen& frame, unsigned char* out, unsigned int start, unsigned int end) {
+  for (unsigned int y = start; y < end; ++y) {
+    const unsigned int* line = frame.pixels + y * frame.stride;
+    unsigned char* rgb = out + (size_t)y * frame.width * 3;
+    for (unsigned int x = 0; x < frame.width; ++x) {
+      rgb[x * 3] = (line[x] >> 16) & 0xff;
+      rgb[x * 3 + 1] = (line[x] >> 8) & 0xff;
+      rgb[x * 3 + 2] = line[x] & 0xff;
+    }
+  }
+}
+
+static void ConvertLuma(const unsigned int* line, unsigned char* luma, unsigned int width) {
+  unsigned int x = 0;
+#ifdef VIDEO_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i coefs = _mm_setr_epi16(25, 129, 66, 0, 25, 129, 66, 0);
+  const __m128i round = _mm_set1_epi32(128);
+  const __m128i offset = _mm_set1_epi32(16);
+  for (; x + 8 <= width; x += 8) {
+    __m128i result[2];
+    for (int half = 0; half < 2; ++half) {
+      __m128i px = _mm_loadu_si128((const __m128i*)(line + x + half * 4));
+      //[b*25 + g*129, r*66] for two pixels in each
+      __m128 lo = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpacklo_epi8(px, zero), coefs));
+      __m128 hi = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpackhi_epi8(px, zero), coefs));
+      __m128i y = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0))),
+        _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1))));
+      result[half] = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(y, round), 8), offset);
+    }
+    __m128i packed = _mm_packs_epi32(result[0], result[1]);
+    _mm_storel_epi64((__m128i*)(luma + x), _mm_packus_epi16(packed, packed));
+  }
+#endif
+  for (; x < width; ++x) {
+    luma[x] = LumaBT601(line[x] & 0xff, (line[x] >> 8) & 0xff, (line[x] >> 16) & 0xff);
+  }
+}
+
+//Two rows into one row of each chroma plane, width is even
+static void ConvertChroma(const unsigned int* line0, const unsigned int* line1,
+  unsigned char* u, unsigned char* v, unsigned int width) {
+  unsigned int x = 0;
+#ifdef VIDEO_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i u_coefs = _mm_setr_epi16(112, -74, -38, 0, 112, -74, -38, 0);
+  const __m128i v_coefs = _mm_setr_epi16(-18, -94, 112, 0, -18, -94, 112, 0);
+  const __m128i round = _mm_set1_epi32(512);
+  const __m128i offset = _mm_set1_epi32(128);
+  for (; x + 8 <= width; x += 8) {
+    __m128 u_sums[2], v_sums[2];
+    for (int half = 0; half < 2; ++half) {
+      __m128i a = _mm_loadu_si128((const __m128i*)(line0 + x + half * 4));
+      __m128i b = _mm_loadu_si128((const __m128i*)(line1 + x + half * 4));
+      __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+      __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+      //BGRA sums of the two 2x2 blocks
+      __m128i block = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+      u_sums[half] = _mm_castsi128_ps(_mm_madd_epi16(block, u_coefs));
+      v_sums[half] = _mm_castsi128_ps(_mm_madd_epi16(block, v_coefs));
+    }
+    __m128i us = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(u_sums[0], u_sums[1], _MM_SHUFFLE(2, 0, 2, 0))),
+      _mm_castps_si128(_mm_shuffle_ps(u_sums[0], u_sums[1], _MM_SHUFFLE(3, 1, 3, 1))));
+    __m128i vs = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(v_sums[0], v_sums[1], _MM_SHUFFLE(2, 0, 2, 0))),
+      _mm_castps_si128(_mm_shuffle_ps(v_sums[0], v_sums[1], _MM_SHUFFLE(3, 1, 3, 1))));
+    us = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(us, round), 10), offset);
+    vs = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(vs, round), 10), offset);
+    //Four u then four v
+    __m128i packed = _mm_packus_epi16(_mm_packs_epi32(us, vs), zero);
+    unsigned int u4 = (unsigned int)_mm_cvtsi128_si32(packed);
+    unsigned int v4 = (unsigned int)_mm_cvtsi128_si32(_mm_srli_si128(packed, 4));
+    memcpy(u + x / 2, &u4, 4);
+    memcpy(v + x / 2, &v4, 4);
+  }
+#endif
+  for (; x < width; x += 2) {
+    int b = 0, g = 0, r = 0;
+    const unsigned int block[4] = { line0[x], line0[x + 1], line1[x], line1[x + 1] };
+    for (int i = 0; i < 4; ++i) {
+      b += block[i] & 0xff;
+      g += (block[i] >> 8) & 0xff;
+      r += (block[i] >> 16) & 0xff;
+    }
+    ChromaBT601(b, g, r, u + x / 2, v + x / 2);
+  }
+}
+
+//I420 planes one after the other, start and end are even
+static void ConvertRowsYUV(const TScreen& frame, unsigned char* out, unsigned int start, unsigned int end) {
+  size_t luma_size = (size_t)frame.width * frame.height;
+  size_t chroma_width = frame.width / 2;
+  unsigned char* u_plane = out + luma_size;
+  unsigned char* v_plane = u_plane + luma_size / 4;
+  for (unsigned int y = start; y < end; y += 2) {
+    const unsigned int* line0 = frame.pixels + y * frame.stride;
+    const unsigned int* line1 = line0 + frame.stride;
+    ConvertLuma(line0, out + (size_t)y * frame.width, frame.width);
+    ConvertLuma(line1, out + (size_t)(y + 1) * frame.width, frame.width);
+    ConvertChroma(line0, line1, u_plane + y / 2 * chroma_width, v_plane + y / 2 * chroma_width, frame.width);
+  }
+}
+
+VideoStream::VideoStream(){
+  file_ = nullptr;
+  format_ = kVideoRGB24;
+  width_ = 0;
+  height_ = 0;
+  schd_ = nullptr;
+  frame_ = nullptr;
+  frames_ = 0;
+  convert_ms_ = 0.0f;
+  write_ms_ = 0.0f;
+}
+
+VideoStream::~VideoStream(){
+  Close();
+}
+
+bool VideoStream::Open(const char* path, VideoFormat format, unsigned int width, unsigned int height,
+  unsigned int fps, px_sched::Scheduler* schd){
+  Close();
+  if (format == kVideoY4M && (width % 2 != 0 || height % 2 != 0)) {
+    fprintf(stderr, "Y4M needs an even width and height\n");
+    return false;
+  }
+
+  if (!strcmp(path, "-")) {
+    //The stream keeps the real stdout, printf goes to stderr from now on
+    fflush(stdout);
+    int fd = dup(fileno(stdout));
+    if (fd < 0) return false;
+    dup2(fileno(stderr), fileno(stdout));
+#ifdef _WIN32
+    _setmode(fd, _O_BINARY);
+#endif
+    file_ = fdopen(fd, "wb");
+  } else {
+    file_ = fopen(path, "wb");
+  }
+  if (!file_) return false;
+#ifndef _WIN32
+  //A reader that goes away fails the writes instead of killing the process
+  signal(SIGPIPE, SIG_IGN);
+#endif
+
+  format_ = format;
+  width_ = width;
+  height_ = height;
+  schd_ = schd;
+  frames_ = 0;
+  convert_ms_ = 0.0f;
+  write_ms_ = 0.0f;
+  size_t pixels = (size_t)width * height;
+  buffer_.resize(format == kVideoY4M ? pixels + pixels / 2 : pixels * 3);
+
+  bands_.resize((height + kRowsPerBand - 1) / kRowsPerBand);
+  for (unsigned int i = 0; i < bands_.size(); ++i) {
+    bands_[i].stream = this;
+    bands_[i].start = i * kRowsPerBand;
+    bands_[i].end = height < (i + 1) * kRowsPerBand ? height : (i + 1) * kRowsPerBand;
+  }
+
+  if (format == kVideoY4M) {
+    //Chroma is the 2x2 box average, centered like in JPEG
+    fprintf(file_, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n", width, height, fps);
+  }
+  return true;
+}
+
+void VideoStream::ConvertJob(void* arg){
+  Band& band = *(Band*)arg;
+  VideoStream* stream = band.stream;
+  if (stream->format_ == kVideoY4M) {
+    ConvertRowsYUV(*stream->frame_, stream->buffer_.data(), band.start, band.end);
+  } else {
+    ConvertRowsRGB24(*stream->frame_, stream->buffer_.data(), band.start, band.end);
+  }
+}
+
+bool VideoStream::WriteFrame(const TScreen& frame){
+  if (!file_ || frame.width != width_ || frame.height != height_) return false;
+
+  auto start = std::chrono::high_resolution_clock::now();
+  frame_ = &frame;
+  px_sched::Sync converted;
+  for (Band& band : bands_) {
+    px_sched::Job job = { &VideoStream::ConvertJob, &band };
+    schd_->run(job, &converted);
+  }
+  schd_->waitFor(converted);
+  frame_ = nullptr;
+  auto converted_time = std::chrono::high_resolution_clock::now();
+
+  bool written = true;
+  if (format_ == kVideoY4M) written = fputs("FRAME\n", file_) >= 0;
+  written = written && fwrite(buffer_.data(), 1, buffer_.size(), file_) == buffer_.size();
+  //The reader sees each frame as soon as it is done
+  written = written && fflush(file_) == 0;
+  auto end = std::chrono::high_resolution_clock::now();
+
+  convert_ms_ += std::chrono::duration<float, std::milli>(converted_time - start).count();
+  write_ms_ += std::chrono::duration<float, std::milli>(end - converted_time).count();
+  if (written) frames_++;
+  return written;
+}
+
+void VideoStream::Close(){
+  if (file_) fclose(file_);
+  file_ = nullptr;
+}